@@ -0,0 +1,452 @@
+/**
+  @file batch.c
+  @brief Coding of many files in one process
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#define _POSIX_C_SOURCE 200809L
+#include "batch.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "core.h"
+#include "fileio.h"
+#include "huffman.h"
+#include "thpool.h"
+
+/**
+  Maximal size of the file coded in memory with the worker buffers.
+  Larger files are coded block by block, so memory usage doesn't depend on the file size.
+*/
+#define BATCH_BUFFERED_SIZE (64u << 20)
+
+/**
+  List of the files to code.
+*/
+typedef struct {
+    char **paths;     /**< paths of the files */
+    char **outPaths;  /**< paths of the coded files, set once the list is complete */
+    size_t count;     /**< number of the files */
+    size_t capacity;  /**< number of the allocated paths */
+} pathlist_t;
+
+/**
+  Batch worker.
+  Takes files one by one until none left, its context and buffer are reused for every file.
+*/
+typedef struct {
+    const pathlist_t *files;  /**< files of the batch */
+    atomic_size_t *next;      /**< index of the next file to take, shared by all the workers */
+    bool encode;              /**< files are encoded, otherwise decoded */
+    huffopts_t opts;          /**< coding options of one file */
+    const huffdict_t *dict;   /**< dictionary of the files, NULL if none */
+    huff_ctx_t *ctx;          /**< context for the files coded in memory */
+    uint8_t *buf;             /**< output buffer for the files coded in memory */
+    size_t buf_size;          /**< size of the output buffer */
+    size_t done;              /**< number of the files coded */
+    size_t failed;            /**< number of the files failed */
+    uint64_t bytesIn;         /**< size of the coded files */
+    uint64_t bytesOut;        /**< size of the written files */
+} batchworker_t;
+
+/**
+  @brief Appends path to the list
+
+  @param[in,out] list pathlist_t * List
+  @param[in] path char * Path to copy
+*/
+static void batch_addPath(pathlist_t *list, char const *path) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->paths = (char**)s_realloc(list->paths, list->capacity * sizeof(char*));
+    }
+    size_t length = strlen(path) + 1;
+    list->paths[list->count] = (char*)s_malloc(length);
+    memcpy(list->paths[list->count++], path, length);
+}
+
+/**
+  @brief Compares paths for sorting
+
+  @param[in] a char ** First path
+  @param[in] b char ** Second path
+  @return strcmp result
+*/
+static int batch_comparePaths(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+  @brief Lists regular files of the directory
+
+  Subdirectories are skipped, files are sorted by name.
+  @param[out] list pathlist_t * List to append to
+  @param[in] dirPath char * Directory
+  @return false if the source isn't a directory
+*/
+static bool batch_listDir(pathlist_t *list, char const *dirPath) {
+    DIR *dir = opendir(dirPath);
+    if (!dir) {
+        return false;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        size_t length = snprintf(NULL, 0, "%s/%s", dirPath, entry->d_name) + 1;
+        char *path = (char*)s_malloc(length);
+        snprintf(path, length, "%s/%s", dirPath, entry->d_name);
+        struct stat st;
+        if (!stat(path, &st) && S_ISREG(st.st_mode)) {
+            batch_addPath(list, path);
+        }
+        free(path);
+    }
+    closedir(dir);
+    qsort(list->paths, list->count, sizeof(char*), batch_comparePaths);
+    return true;
+}
+
+/**
+  @brief Lists files named in the list file
+
+  Every line holds one path, empty lines are skipped.
+  @param[out] list pathlist_t * List to append to
+  @param[in] listPath char * List file
+  @return false if the list can't be read
+*/
+static bool batch_listFile(pathlist_t *list, char const *listPath) {
+    FILE *file = fopen(listPath, "r");
+    if (!file) {
+        return false;
+    }
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, file)) >= 0) {
+        while (length && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length) {
+            batch_addPath(list, line);
+        }
+    }
+    bool ok = !ferror(file);
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+/**
+  @brief Reports failure of one file
+
+  @param[in] path char * File
+  @param[in] message char * Reason of the failure
+*/
+static void batch_fileError(char const *path, char const *message) {
+    size_t length = snprintf(NULL, 0, "%s: %s", path, message) + 1;
+    char *text = (char*)s_malloc(length);
+    snprintf(text, length, "%s: %s", path, message);
+    printError(text);
+    free(text);
+}
+
+/**
+  @brief Makes path of the coded file
+
+  Encoded file gets BATCH_SUFFIX, decoded file loses it or gets BATCH_DECODED_SUFFIX.
+  @param[in] outDir char * Directory for the coded files
+  @param[in] encode bool File is encoded, otherwise decoded
+  @param[in] path char * Path of the input file
+  @return Allocated path in the output directory
+*/
+static char* batch_outPath(char const *outDir, bool encode, char const *path) {
+    char const *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    size_t nameLength = strlen(name);
+    char const *suffix = BATCH_SUFFIX;
+    if (!encode) {
+        size_t suffixLength = strlen(BATCH_SUFFIX);
+        if (nameLength > suffixLength && !strcmp(name + nameLength - suffixLength, BATCH_SUFFIX)) {
+            nameLength -= suffixLength;
+            suffix = "";
+        } else {
+            suffix = BATCH_DECODED_SUFFIX;
+        }
+    }
+    size_t length = snprintf(NULL, 0, "%s/%.*s%s", outDir, (int)nameLength, name, suffix) + 1;
+    char *outPath = (char*)s_malloc(length);
+    snprintf(outPath, length, "%s/%.*s%s", outDir, (int)nameLength, name, suffix);
+    return outPath;
+}
+
+/**
+  @brief Compares output paths for sorting, equal paths keep the list order
+
+  @param[in] a char *** Pointer to the first output path in the list outPaths
+  @param[in] b char *** Pointer to the second output path in the list outPaths
+  @return Comparison result
+*/
+static int batch_compareOutPaths(const void *a, const void *b) {
+    char **outA = *(char ** const *)a;
+    char **outB = *(char ** const *)b;
+    int order = strcmp(*outA, *outB);
+    return order ? order : (outA > outB) - (outA < outB);
+}
+
+/**
+  @brief Makes output paths of the listed files and drops files whose output repeats an earlier one
+
+  Output keeps only the file name, so files of different directories may get the same output,
+  which their workers would write at once.
+  @param[in,out] list pathlist_t * Complete list, gets outPaths
+  @param[in] outDir char * Directory for the coded files
+  @param[in] encode bool Files are encoded, otherwise decoded
+  @return Number of the dropped files
+*/
+static size_t batch_setOutPaths(pathlist_t *list, char const *outDir, bool encode) {
+    list->outPaths = (char**)s_malloc((list->count ? list->count : 1) * sizeof(char*));
+    char ***sorted = (char***)s_malloc((list->count ? list->count : 1) * sizeof(char**));
+    for (size_t i = 0; i < list->count; i++) {
+        list->outPaths[i] = batch_outPath(outDir, encode, list->paths[i]);
+        sorted[i] = &list->outPaths[i];
+    }
+    qsort(sorted, list->count, sizeof(char**), batch_compareOutPaths);
+    // the first file of every output is coded, the following ones fail
+    size_t dropped = 0;
+    for (size_t i = 1; i < list->count; i++) {
+        if (!strcmp(*sorted[i - 1], *sorted[i])) {
+            size_t index = sorted[i] - list->outPaths;
+            batch_fileError(list->paths[index], BATCH_DUPLICATE_OUTPUT);
+            free(list->paths[index]);
+            list->paths[index] = NULL;
+            dropped++;
+        }
+    }
+    free(sorted);
+    size_t count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->paths[i]) {
+            list->paths[count] = list->paths[i];
+            list->outPaths[count++] = list->outPaths[i];
+        } else {
+            free(list->outPaths[i]);
+        }
+    }
+    list->count = count;
+    return dropped;
+}
+
+/**
+  @brief Grows the worker output buffer
+
+  @param[in,out] worker batchworker_t * Worker
+  @param[in] size size_t Required size
+  @return HUFF_OK or HUFF_ERR_MEMORY
+*/
+static huff_status_t batch_reserve(batchworker_t *worker, size_t size) {
+    if (worker->buf_size < size) {
+        uint8_t *buf = (uint8_t*)realloc(worker->buf, size);
+        if (!buf) {
+            return HUFF_ERR_MEMORY;
+        }
+        worker->buf = buf;
+        worker->buf_size = size;
+    }
+    return HUFF_OK;
+}
+
+/**
+  @brief Encodes one file
+
+  Small mapped files are compressed in memory with the worker context, others are encoded block by block.
+  @param[in,out] worker batchworker_t * Worker
+  @param[in] input FILE * File to encode
+  @param[in] output FILE * File to write code to
+  @return HUFF_OK or error code
+*/
+static huff_status_t batch_encode(batchworker_t *worker, FILE *input, FILE *output) {
+    fin_t in;
+    fin_open(&in, input);
+    uint64_t size = fin_mapped(&in);
+    if (!in.map || size > BATCH_BUFFERED_SIZE) {
+        fin_close(&in);
+        return encodeFile(input, output, &worker->opts, worker->dict, NULL);
+    }
+    size_t encodedSize = 0;
+    huff_status_t status = batch_reserve(worker, huff_compressBound(worker->ctx, size));
+    if (status == HUFF_OK) {
+        status = huff_compress(worker->ctx, in.map + in.pos, size, worker->buf, worker->buf_size, &encodedSize);
+    }
+    if (status == HUFF_OK && fwrite(worker->buf, 1, encodedSize, output) != encodedSize) {
+        status = HUFF_ERR_IO;
+    }
+    fin_close(&in);
+    return status;
+}
+
+/**
+  @brief Decodes one file
+
+  Small mapped files of known content size are decompressed in memory with the worker context,
+  others are decoded block by block.
+  @param[in,out] worker batchworker_t * Worker
+  @param[in] input FILE * File to decode
+  @param[in] output FILE * File to write decoded text to
+  @return HUFF_OK or error code
+*/
+static huff_status_t batch_decode(batchworker_t *worker, FILE *input, FILE *output) {
+    fin_t in;
+    fin_open(&in, input);
+    uint64_t size = fin_mapped(&in);
+    fileheader_t header;
+    if (size >= sizeof(header)) {
+        memcpy(&header, in.map + in.pos, sizeof(header));
+    }
+    if (size < sizeof(header) || checkFileHeader(&header) != HUFF_OK
+        || !(header.flags & HUFF_FLAG_CONTENT_SIZE) || header.contentSize > BATCH_BUFFERED_SIZE) {
+        fin_close(&in);
+        return decodeFile(input, output, &worker->opts, worker->dict, NULL);
+    }
+    size_t decodedSize = 0;
+    huff_status_t status = batch_reserve(worker, header.contentSize ? header.contentSize : 1);
+    if (status == HUFF_OK) {
+        status = huff_decompress(worker->ctx, in.map + in.pos, size, worker->buf, header.contentSize, &decodedSize);
+    }
+    if (status == HUFF_OK && fwrite(worker->buf, 1, decodedSize, output) != decodedSize) {
+        status = HUFF_ERR_IO;
+    }
+    fin_close(&in);
+    return status;
+}
+
+/**
+  @brief Codes one file of the batch
+
+  Output of the failed file is removed.
+  @param[in,out] worker batchworker_t * Worker
+  @param[in] path char * File to code
+  @param[in] outPath char * Coded file
+*/
+static void batch_codeFile(batchworker_t *worker, char const *path, char const *outPath) {
+    FILE *input = fopen(path, "rb");
+    // decoder maps the output, so it should be readable too
+    FILE *output = input ? fopen(outPath, worker->encode ? "wb" : "w+b") : NULL;
+    huff_status_t status = HUFF_OK;
+    if (!input || !output) {
+        batch_fileError(!input ? path : outPath, S_FOPEN_FAILED);
+        worker->failed++;
+    } else {
+        status = worker->encode ? batch_encode(worker, input, output) : batch_decode(worker, input, output);
+        // empty input gives empty output, as it does for a single file
+        if (status != HUFF_OK && status != HUFF_ERR_EMPTY) {
+            batch_fileError(path, huff_strerror(status));
+        }
+    }
+    if (input) {
+        fseeko(input, 0, SEEK_END);
+        worker->bytesIn += ftello(input) > 0 ? (uint64_t)ftello(input) : 0;
+        fclose(input);
+    }
+    if (output) {
+        fflush(output);
+        worker->bytesOut += ftello(output) > 0 ? (uint64_t)ftello(output) : 0;
+        if (fclose(output) && (status == HUFF_OK || status == HUFF_ERR_EMPTY)) {
+            batch_fileError(outPath, huff_strerror(HUFF_ERR_IO));
+            status = HUFF_ERR_IO;
+        }
+        if (status != HUFF_OK && status != HUFF_ERR_EMPTY) {
+            worker->failed++;
+            remove(outPath);
+        } else {
+            worker->done++;
+        }
+    }
+}
+
+/**
+  @brief Batch worker job
+
+  @param[in] arg batchworker_t * Worker
+*/
+static void batch_job(void *arg) {
+    batchworker_t *worker = (batchworker_t*)arg;
+    size_t index;
+    while ((index = atomic_fetch_add(worker->next, 1)) < worker->files->count) {
+        batch_codeFile(worker, worker->files->paths[index], worker->files->outPaths[index]);
+    }
+}
+
+size_t batch_run(char const *source, char const *outDir, bool encode, const huffopts_t *opts,
+                 const uint8_t *dictData, size_t dictSize) {
+    double start = st_now();
+    pathlist_t files = {NULL, NULL, 0, 0};
+    struct stat st;
+    if (stat(source, &st) || !(S_ISDIR(st.st_mode) ? batch_listDir(&files, source) : batch_listFile(&files, source))) {
+        printError(BATCH_SOURCE_FAILED);
+        s_exit(EXIT_FAILURE);
+    }
+    if (mkdir(outDir, 0777) && (errno != EEXIST || stat(outDir, &st) || !S_ISDIR(st.st_mode))) {
+        printError(BATCH_OUTDIR_FAILED);
+        s_exit(EXIT_FAILURE);
+    }
+    size_t dropped = batch_setOutPaths(&files, outDir, encode);
+
+    // large files are coded block by block with the dictionary parsed once
+    huffdict_t *dict = NULL;
+    if (dictData) {
+        dict = (huffdict_t*)s_malloc(sizeof(huffdict_t));
+        if (readDict(dictData, dictSize, dict) != HUFF_OK) {
+            printError(huff_strerror(HUFF_ERR_DICT));
+            s_exit(EXIT_FAILURE);
+        }
+    }
+
+    // every worker codes whole files on its own thread
+    size_t threads = opts->threads < files.count ? opts->threads : files.count ? files.count : 1;
+    atomic_size_t next = 0;
+    batchworker_t *workers = (batchworker_t*)s_calloc(threads, sizeof(batchworker_t));
+    for (size_t i = 0; i < threads; i++) {
+        workers[i].files = &files;
+        workers[i].next = &next;
+        workers[i].encode = encode;
+        workers[i].opts = *opts;
+        workers[i].opts.threads = 1;
+        workers[i].dict = dict;
+        workers[i].ctx = huff_init(&workers[i].opts);
+        if (!workers[i].ctx || (dictData && huff_loadDict(workers[i].ctx, dictData, dictSize) != HUFF_OK)) {
+            printError(S_MALLOC_FAILED);
+            s_exit(EXIT_FAILURE);
+        }
+    }
+    thpool_t *pool = tp_init(threads);
+    tp_run(pool, batch_job, workers, sizeof(batchworker_t), threads);
+    tp_free(&pool);
+
+    batchworker_t total = {0};
+    total.failed = dropped;
+    for (size_t i = 0; i < threads; i++) {
+        total.done += workers[i].done;
+        total.failed += workers[i].failed;
+        total.bytesIn += workers[i].bytesIn;
+        total.bytesOut += workers[i].bytesOut;
+        huff_free(&workers[i].ctx);
+        free(workers[i].buf);
+    }
+    free(workers);
+    free(dict);
+    for (size_t i = 0; i < files.count; i++) {
+        free(files.paths[i]);
+        free(files.outPaths[i]);
+    }
+    free(files.paths);
+    free(files.outPaths);
+
+    // throughput is counted by the original text size
+    double seconds = st_now() - start;
+    uint64_t textSize = encode ? total.bytesIn : total.bytesOut;
+    printf(BATCH_REPORT, total.done + total.failed, total.failed, (unsigned long long)total.bytesIn,
+           (unsigned long long)total.bytesOut, seconds, seconds > 0 ? textSize / seconds / 1e6 : 0);
+    return total.failed;
+}
@@ -0,0 +1,46 @@
+/**
+  @file batch.h
+  @brief Coding of many files in one process
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "libhuff.h"
+
+/**
+  Suffix of the encoded files, removed from the decoded ones.
+*/
+#define BATCH_SUFFIX ".huf"
+/**
+  Suffix of the decoded files whose names don't end with BATCH_SUFFIX.
+*/
+#define BATCH_DECODED_SUFFIX ".out"
+
+/**
+  @brief Codes many files in one process
+
+  Files are taken from the directory or from the list file with one path per line.
+  They are coded by opts->threads workers, every worker codes one file at a time on its own thread
+  and reuses its context and buffers for the next files.
+  Failure of one file is reported and doesn't stop the others.
+  Coded files keep only the input file name, so of the files getting the same output name only the first one is coded.
+  Prints number of files, sizes and throughput of the whole batch.
+  @param[in] source char * Directory or list file
+  @param[in] outDir char * Directory for the coded files, created if missing
+  @param[in] encode bool Encode files, decode otherwise
+  @param[in] opts huffopts_t * Coding options
+  @param[in] dictData uint8_t * Content of the dictionary file, NULL if files don't use one
+  @param[in] dictSize size_t Size of the dictionary file
+  @return Number of files which failed
+*/
+size_t batch_run(char const *source, char const *outDir, bool encode, const huffopts_t *opts,
+                 const uint8_t *dictData, size_t dictSize);
+
+#endif /* end of include guard: BATCH_H */
@@ -0,0 +1,413 @@
+/**
+  @file bench.c
+  @brief Huffman coding benchmark
+
+  Times every coding stage on generated corpora and given files,
+  prints a table and writes results in CSV format.
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include "core.h"
+#include "huffman.h"
+
+#define BENCH_DEFAULT_SIZE (8u << 20)
+#define BENCH_DEFAULT_RUNS 5
+#define BENCH_SEED 0x9E3779B97F4A7C15ull
+
+/**
+  Benchmarked stages.
+*/
+typedef enum {
+    STAGE_HIST,
+    STAGE_TABLE,
+    STAGE_ENCODE,
+    STAGE_DECODE,
+    STAGE_COUNT
+} stage_t;
+
+static const char *stageNames[STAGE_COUNT] = {"hist", "table", "encode", "decode"};
+
+/**
+  Benchmark input.
+*/
+typedef struct {
+    char const *name;  /**< corpus name */
+    uint8_t *data;     /**< corpus content */
+    size_t size;       /**< corpus size */
+} corpus_t;
+
+/**
+  @brief Generates next pseudorandom number
+
+  xorshift64* generator, so corpora are the same on every machine.
+  @param[in,out] state uint64_t * Generator state
+  @return Pseudorandom number
+*/
+static uint64_t bench_rand(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Dull;
+}
+
+/**
+  @brief Builds cumulative Zipf distribution
+
+  @param[out] cdf double * Cumulative probabilities, count elements
+  @param[in] count size_t Number of ranks
+  @param[in] exponent double Zipf exponent
+*/
+static void bench_zipf(double *cdf, size_t count, double exponent) {
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += 1.0 / pow(i + 1, exponent);
+        cdf[i] = sum;
+    }
+    for (size_t i = 0; i < count; i++) {
+        cdf[i] /= sum;
+    }
+}
+
+/**
+  @brief Picks rank from cumulative distribution
+
+  @param[in] cdf double * Cumulative probabilities
+  @param[in] count size_t Number of ranks
+  @param[in,out] state uint64_t * Generator state
+  @return Rank
+*/
+static size_t bench_pick(const double *cdf, size_t count, uint64_t *state) {
+    double x = (bench_rand(state) >> 11) * (1.0 / (1ull << 53));
+    size_t lo = 0, hi = count - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cdf[mid] < x) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+  @brief Generates text-like corpus
+
+  Words of a random vocabulary are taken with Zipf distribution and split into sentences and lines.
+  @param[out] data uint8_t * Buffer to fill
+  @param[in] size size_t Size of the buffer
+  @param[in,out] state uint64_t * Generator state
+*/
+static void bench_text(uint8_t *data, size_t size, uint64_t *state) {
+    enum {WORDS = 4096, WORD_LEN = 12};
+    static const char letters[] = "etaoinshrdlucmfwypvbgkjqxz";
+    static char words[WORDS][WORD_LEN + 1];
+    static double cdf[WORDS];
+    double letterCdf[sizeof(letters) - 1];
+    bench_zipf(letterCdf, sizeof(letters) - 1, 0.8);
+    for (size_t i = 0; i < WORDS; i++) {
+        size_t len = 1 + bench_rand(state) % 3 + bench_rand(state) % (WORD_LEN - 2);
+        for (size_t j = 0; j < len; j++) {
+            words[i][j] = letters[bench_pick(letterCdf, sizeof(letters) - 1, state)];
+        }
+        words[i][len] = '\0';
+    }
+    bench_zipf(cdf, WORDS, 1.0);
+
+    size_t pos = 0, sentence = 0, line = 0;
+    bool capital = true;
+    while (pos < size) {
+        const char *word = words[bench_pick(cdf, WORDS, state)];
+        for (size_t j = 0; word[j] && pos < size; j++, line++) {
+            data[pos++] = capital && !j ? (uint8_t)(word[j] - 'a' + 'A') : (uint8_t)word[j];
+        }
+        capital = false;
+        if (++sentence > 4 + bench_rand(state) % 16) {
+            sentence = 0;
+            capital = true;
+            if (pos < size) {
+                data[pos++] = '.';
+            }
+        } else if (!(bench_rand(state) % 12) && pos < size) {
+            data[pos++] = ',';
+        }
+        if (pos < size) {
+            data[pos++] = line > 72 ? '\n' : ' ';
+            line = line > 72 ? 0 : line + 1;
+        }
+    }
+}
+
+/**
+  @brief Generates synthetic corpus
+
+  @param[out] corpus corpus_t * Corpus to generate, name selects the content
+  @param[in] size size_t Corpus size
+*/
+static void bench_generate(corpus_t *corpus, size_t size) {
+    uint64_t state = BENCH_SEED;
+    corpus->size = size;
+    corpus->data = (uint8_t*)s_malloc(size ? size : 1);
+    if (!strcmp(corpus->name, "uniform")) {
+        for (size_t i = 0; i < size; i++) {
+            corpus->data[i] = (uint8_t)(bench_rand(&state) >> 56);
+        }
+    } else if (!strcmp(corpus->name, "zipf")) {
+        double cdf[INBUF_T_LIM];
+        bench_zipf(cdf, INBUF_T_LIM, 1.2);
+        for (size_t i = 0; i < size; i++) {
+            corpus->data[i] = (uint8_t)bench_pick(cdf, INBUF_T_LIM, &state);
+        }
+    } else if (!strcmp(corpus->name, "text")) {
+        bench_text(corpus->data, size, &state);
+    } else if (!strcmp(corpus->name, "runs")) {
+        for (size_t i = 0; i < size;) {
+            uint8_t symb = (uint8_t)(bench_rand(&state) % 16);
+            for (size_t run = 1 + bench_rand(&state) % 512; run && i < size; run--) {
+                corpus->data[i++] = symb;
+            }
+        }
+    } else {
+        memset(corpus->data, 'a', size);
+    }
+}
+
+/**
+  @brief Reads file corpus
+
+  @param[out] corpus corpus_t * Corpus to read, name is the file name
+*/
+static void bench_load(corpus_t *corpus) {
+    FILE *file = s_fopen(corpus->name, "rb");
+    corpus->size = getFileSize(file);
+    corpus->data = (uint8_t*)s_malloc(corpus->size ? corpus->size : 1);
+    if (fread(corpus->data, 1, corpus->size, file) != corpus->size) {
+        printError(BENCH_READ_FAILED);
+        s_exit(EXIT_FAILURE);
+    }
+    fclose(file);
+}
+
+/**
+  @brief Gets monotonic time
+
+  @return Time in seconds
+*/
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+  @brief Compares run times for qsort
+
+  @param[in] a void * Pointer to the first time
+  @param[in] b void * Pointer to the second time
+  @return Negative, zero or positive value as for qsort
+*/
+static int bench_cmpTime(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+  @brief Gets percentile of sorted run times
+
+  Nearest rank method.
+  @param[in] times double * Sorted run times
+  @param[in] count size_t Number of runs
+  @param[in] percent double Percentile
+  @return Run time
+*/
+static double bench_percentile(const double *times, size_t count, double percent) {
+    size_t rank = (size_t)ceil(percent / 100 * count);
+    return times[rank ? rank - 1 : 0];
+}
+
+/**
+  @brief Benchmarks all the stages on one corpus
+
+  Every run codes the whole corpus block by block, time of every stage is summed over the blocks.
+  Decoded blocks are checked against the original.
+  @param[in] corpus corpus_t * Corpus
+  @param[in] opts huffopts_t * Encoder options
+  @param[in] runs size_t Number of runs
+  @param[out] times double[] Run times of every stage, runs elements each
+  @return Size of the encoded corpus with all the headers
+*/
+static size_t bench_corpus(const corpus_t *corpus, const huffopts_t *opts, size_t runs, double *times[STAGE_COUNT]) {
+    blockscratch_t *scratch = (blockscratch_t*)s_calloc(1, sizeof(blockscratch_t));
+    blockscratch_t *decodeScratch = (blockscratch_t*)s_calloc(1, sizeof(blockscratch_t));
+    reftable_t *ref = (reftable_t*)s_calloc(1, sizeof(reftable_t));
+    reftable_t *decodeRef = (reftable_t*)s_calloc(1, sizeof(reftable_t));
+    size_t bound = blockPayloadBound(opts->blockSize, opts);
+    uint8_t *payload = (uint8_t*)s_calloc(bound + sizeof(OUTBUF_T), 1);
+    uint8_t *decoded = (uint8_t*)s_malloc(opts->blockSize);
+    size_t encodedSize = 0;
+
+    for (size_t run = 0; run < runs; run++) {
+        double stageTime[STAGE_COUNT] = {0};
+        encodedSize = sizeof(fileheader_t) + sizeof(blockheader_t);
+        // every run starts a new chain of repeated tables
+        ref->id = decodeRef->id = 0;
+        scratch->tableId = decodeScratch->tableId = decodeScratch->decodeTableId = 0;
+        for (size_t offset = 0; offset < corpus->size; offset += opts->blockSize) {
+            const uint8_t *block = corpus->data + offset;
+            uint32_t blockSize = corpus->size - offset < opts->blockSize ? corpus->size - offset : opts->blockSize;
+
+            double start = bench_now();
+            countBlockSymbols(block, blockSize, opts, scratch);
+            double histEnd = bench_now();
+            selectCodeTable(ref, opts, scratch);
+            double tableEnd = bench_now();
+            size_t payloadSize = encodeBlock(block, blockSize, payload, opts, scratch);
+            double encodeEnd = bench_now();
+            // bit reader peeks one word past the payload
+            memset(payload + payloadSize, 0, sizeof(OUTBUF_T));
+            bool ok = readBlockTable(payload, payloadSize, opts, decodeRef, decodeScratch)
+                      && decodeBlock(payload, payloadSize, decoded, blockSize, decodeScratch, opts);
+            double decodeEnd = bench_now();
+
+            if (!ok || memcmp(decoded, block, blockSize)) {
+                printError(BENCH_MISMATCH);
+                s_exit(EXIT_FAILURE);
+            }
+            stageTime[STAGE_HIST] += histEnd - start;
+            stageTime[STAGE_TABLE] += tableEnd - histEnd;
+            stageTime[STAGE_ENCODE] += encodeEnd - tableEnd;
+            stageTime[STAGE_DECODE] += decodeEnd - encodeEnd;
+            encodedSize += sizeof(blockheader_t) + payloadSize;
+        }
+        for (size_t stage = 0; stage < STAGE_COUNT; stage++) {
+            times[stage][run] = stageTime[stage];
+        }
+    }
+
+    free(decoded);
+    free(payload);
+    free(decodeRef);
+    free(ref);
+    free(decodeScratch);
+    free(scratch);
+    return encodedSize;
+}
+
+/**
+  @brief Prints and saves results of one corpus
+
+  Gain is the size reduction against the order-0 coding of the same corpus.
+  @param[in] corpus corpus_t * Corpus
+  @param[in] encodedSize size_t Size of the encoded corpus
+  @param[in] order0Size size_t Size of the corpus encoded in HUFF_MODE_ORDER0
+  @param[in] runs size_t Number of runs
+  @param[in,out] times double[] Run times of every stage, sorted in place
+  @param[in] csv FILE * Results file, may be NULL
+*/
+static void bench_report(const corpus_t *corpus, size_t encodedSize, size_t order0Size, size_t runs, double *times[STAGE_COUNT], FILE *csv) {
+    double ratio = corpus->size ? (double)encodedSize / corpus->size : 0;
+    double gain = order0Size ? 100 * (1 - (double)encodedSize / order0Size) : 0;
+    for (size_t stage = 0; stage < STAGE_COUNT; stage++) {
+        qsort(times[stage], runs, sizeof(double), bench_cmpTime);
+        double median = bench_percentile(times[stage], runs, 50);
+        double p99 = bench_percentile(times[stage], runs, 99);
+        double speed = median > 0 ? corpus->size / median / 1e6 : 0;
+        printf("%-16.16s %12zu %7.4f %7.2f %-7s %10.1f %10.3f %10.3f\n",
+               corpus->name, corpus->size, ratio, gain, stageNames[stage], speed, median * 1e3, p99 * 1e3);
+        if (csv) {
+            fprintf(csv, "%s,%zu,%zu,%.6f,%zu,%.4f,%s,%zu,%.3f,%.6f,%.6f\n",
+                    corpus->name, corpus->size, encodedSize, ratio, order0Size, gain, stageNames[stage], runs, speed, median * 1e3, p99 * 1e3);
+        }
+    }
+}
+
+/**
+  @brief Benchmark entry point
+
+  Usage: huffbench [-n runs] [-s size] [-B size] [-S streams] [--max-code-len len] [-m mode] [-o results.csv] [files...]
+  @param[in] argc int Number of command line arguments given
+  @param[in] argv char*[] Array of command line arguments
+  @return 0
+*/
+int main(int argc, char const *argv[]) {
+    static char const *generated[] = {"uniform", "zipf", "text", "runs", "single"};
+    huffopts_t opts;
+    huff_initOpts(&opts);
+    size_t runs = BENCH_DEFAULT_RUNS;
+    size_t size = BENCH_DEFAULT_SIZE;
+    char const *csvName = NULL;
+    char const **files = (char const**)s_calloc(argc, sizeof(char*));
+    size_t fileCount = 0;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-n") && hasValue) {
+            runs = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-s") && hasValue) {
+            size = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-B") && hasValue) {
+            opts.blockSize = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-S") && hasValue) {
+            opts.streams = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--max-code-len") && hasValue) {
+            opts.maxCodeLen = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "-m") && hasValue) {
+            i++;
+            opts.mode = !strcmp(argv[i], "ctx1") ? HUFF_MODE_CTX1 : !strcmp(argv[i], "order0") ? HUFF_MODE_ORDER0 : UINT8_MAX;
+        } else if (!strcmp(argv[i], "-o") && hasValue) {
+            csvName = argv[++i];
+        } else if (argv[i][0] == '-') {
+            printError(WRONG_ARG);
+            printf("%s\n", BENCH_USAGE_MSG);
+            exit(0);
+        } else {
+            files[fileCount++] = argv[i];
+        }
+    }
+    if (!runs || huff_checkOpts(&opts) != HUFF_OK) {
+        printError(WRONG_PARAM);
+        exit(0);
+    }
+
+    FILE *csv = csvName ? s_fopen(csvName, "w") : NULL;
+    if (csv) {
+        fprintf(csv, "corpus,size,encoded,ratio,order0_encoded,gain_pct,stage,runs,mbps,median_ms,p99_ms\n");
+    }
+    printf("%-16s %12s %7s %7s %-7s %10s %10s %10s\n", "corpus", "size", "ratio", "gain %", "stage", "MB/s", "median ms", "p99 ms");
+
+    double *times[STAGE_COUNT];
+    for (size_t stage = 0; stage < STAGE_COUNT; stage++) {
+        times[stage] = (double*)s_malloc(runs * sizeof(double));
+    }
+    size_t generatedCount = sizeof(generated) / sizeof(generated[0]);
+    for (size_t i = 0; i < generatedCount + fileCount; i++) {
+        corpus_t corpus = {i < generatedCount ? generated[i] : files[i - generatedCount], NULL, 0};
+        if (i < generatedCount) {
+            bench_generate(&corpus, size);
+        } else {
+            bench_load(&corpus);
+        }
+        // order-0 size is the baseline of the other modes
+        huffopts_t order0 = opts;
+        order0.mode = HUFF_MODE_ORDER0;
+        size_t order0Size = opts.mode != HUFF_MODE_ORDER0 ? bench_corpus(&corpus, &order0, 1, times) : 0;
+        size_t encodedSize = bench_corpus(&corpus, &opts, runs, times);
+        bench_report(&corpus, encodedSize, order0Size ? order0Size : encodedSize, runs, times, csv);
+        free(corpus.data);
+    }
+
+    for (size_t stage = 0; stage < STAGE_COUNT; stage++) {
+        free(times[stage]);
+    }
+    free(files);
+    if (csv) {
+        fclose(csv);
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+/**
+  @file bitio.h
+  @brief Bit level readers and writers for the encoded text
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#ifndef BITIO_H
+#define BITIO_H
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+  Maximal number of bits written between two flushes.
+  Flush leaves at most 7 bits in the accumulator, so it never gets full.
+*/
+#define BW_FLUSH_BITS 56
+
+/**
+  @brief Converts 64-bit word between big endian and native byte order
+
+  @param[in] word uint64_t Word to convert
+  @return Converted word
+*/
+static inline uint64_t bio_bigEndian(uint64_t word) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return word;
+#else
+    return __builtin_bswap64(word);
+#endif
+}
+
+/**
+  Bit reader structure.
+  Reads bits starting from the most significant bit of each byte.
+  Buffer should be followed by one extra 64-bit word, so that peeking at the end of the buffer stays in bounds.
+*/
+typedef struct {
+    const uint8_t *bytes;  /**< encoded text */
+    uint64_t pos;          /**< number of already consumed bits */
+} bitreader_t;
+
+/**
+  @brief Initialize bit reader
+
+  @param[out] br bitreader_t * Reader to initialize
+  @param[in] bytes uint8_t * Buffer to read bits from
+*/
+static inline void br_init(bitreader_t *br, const uint8_t *bytes) {
+    br->bytes = bytes;
+    br->pos = 0;
+}
+
+/**
+  @brief Peek next bits of the buffer without consuming them
+
+  Next unread bit is returned in the most significant bit of the result.
+  At least 57 bits are valid, the rest are zeros.
+  @param[in] br bitreader_t * Reader
+  @return Next bits of the buffer
+*/
+static inline uint64_t br_peek(const bitreader_t *br) {
+    uint64_t word;
+    memcpy(&word, br->bytes + (br->pos >> 3), sizeof(word));
+    return bio_bigEndian(word) << (br->pos & 7);
+}
+
+/**
+  @brief Consume bits
+
+  @param[in] br bitreader_t * Reader
+  @param[in] count unsigned Number of bits to skip
+*/
+static inline void br_skip(bitreader_t *br, unsigned count) {
+    br->pos += count;
+}
+
+/**
+  @brief Read bits
+
+  @param[in] br bitreader_t * Reader
+  @param[in] count unsigned Number of bits to read, up to 57
+  @return Bits read, the last read bit in the least significant bit of the result
+*/
+static inline uint64_t br_read(bitreader_t *br, unsigned count) {
+    // double shift keeps the shift count below 64 when count is 0
+    uint64_t bits = (br_peek(br) >> 1) >> (63 - count);
+    br->pos += count;
+    return bits;
+}
+
+/**
+  Bit writer structure.
+  Codes are appended to the 64-bit accumulator kept in registers,
+  whole bytes of it are stored to the buffer by unaligned 64-bit stores.
+  Every store writes 8 bytes, so the buffer needs 8 bytes of slack after the written data.
+*/
+typedef struct {
+    uint8_t *ptr;   /**< place of the first accumulator byte in the buffer */
+    uint64_t acc;   /**< pending bits, aligned to the most significant bit */
+    unsigned bits;  /**< number of pending bits */
+} bitwriter_t;
+
+/**
+  @brief Initialize bit writer
+
+  @param[out] bw bitwriter_t * Writer to initialize
+  @param[in] bytes uint8_t * Buffer to write bits to
+*/
+static inline void bw_init(bitwriter_t *bw, uint8_t *bytes) {
+    bw->ptr = bytes;
+    bw->acc = 0;
+    bw->bits = 0;
+}
+
+/**
+  @brief Append code to the accumulator
+
+  No more than BW_FLUSH_BITS bits can be written between two flushes.
+  @param[in] bw bitwriter_t * Writer
+  @param[in] code uint64_t Code, only len least significant bits may be set
+  @param[in] len unsigned Code length, at least 1
+*/
+static inline void bw_write(bitwriter_t *bw, uint64_t code, unsigned len) {
+    bw->acc |= code << (64 - bw->bits - len);
+    bw->bits += len;
+}
+
+/**
+  @brief Store whole bytes of the accumulator to the buffer
+
+  @param[in] bw bitwriter_t * Writer
+*/
+static inline void bw_flush(bitwriter_t *bw) {
+    uint64_t word = bio_bigEndian(bw->acc);
+    memcpy(bw->ptr, &word, sizeof(word));
+    bw->ptr += bw->bits >> 3;
+    bw->acc <<= bw->bits & ~7u;
+    bw->bits &= 7;
+}
+
+/**
+  @brief Store all the pending bits, padding the last byte with zeros
+
+  @param[in] bw bitwriter_t * Writer
+  @return Pointer past the last written byte
+*/
+static inline uint8_t* bw_finish(bitwriter_t *bw) {
+    bw_flush(bw);
+    if (bw->bits) {
+        bw->ptr++;
+        bw->acc = 0;
+        bw->bits = 0;
+    }
+    return bw->ptr;
+}
+
+#endif /* end of include guard: BITIO_H */
@@ -8,74 +8,36 @@
 */
 #include "btree.h"
 
-bt_t *bt_init(void) {
-    bt_t *newTree = (bt_t*)s_malloc(sizeof(bt_t));
-    newTree->root = NULL;
-    newTree->count = 0;
-    return newTree;
+void bt_init(bt_t *tree, btnode_t *nodes) {
+    tree->nodes = nodes;
+    tree->count = 0;
+    tree->root = BT_NIL;
 }
 
-/**
-  @brief Destroy subtree nodes
-
-  Frees all the nodes recursivly.
-  @param[in] tree btnode_t ** Subtree root
-*/
-void bt_freeSubtree(btnode_t **subtreeRoot) {
-    if(!subtreeRoot || !*subtreeRoot) {
-        return;
-    }
-    bt_freeSubtree(&(*subtreeRoot)->left);
-    bt_freeSubtree(&(*subtreeRoot)->right);
-    free(*subtreeRoot);
-    *subtreeRoot = NULL;
+btindex_t bt_leaf(bt_t *tree, uint16_t symb, uint64_t freq) {
+    btindex_t index = tree->count++;
+    tree->nodes[index] = (btnode_t){freq, BT_NIL, BT_NIL, symb};
+    tree->root = index;
+    return index;
 }
 
-void bt_free(bt_t **tree) {
-    bt_freeSubtree(&(*tree)->root);
-    free(*tree);
-    *tree = NULL;
+btindex_t bt_join(bt_t *tree, btindex_t left, btindex_t right) {
+    btindex_t index = tree->count++;
+    tree->nodes[index] = (btnode_t){tree->nodes[left].freq + tree->nodes[right].freq, left, right, 0};
+    tree->root = index;
+    return index;
 }
 
-int bt_insert(bt_t *tree, btdata_t item) {
-    btnode_t *curNode = tree->root;
-    btnode_t **newNode = &tree->root;
-
-    while(true) {
-        if(!curNode) {
-            curNode = *newNode = (btnode_t*)s_malloc(sizeof(btnode_t));
-            curNode->left = curNode->right = NULL;
-            curNode->data = item;
-            tree->count++;
-            return 1;
-        } else if(item.symb == curNode->data.symb) {
-            curNode->data.freq = item.freq;
-            return 2;
-        } else if(item.freq < curNode->data.freq) {
-            newNode = &curNode->right;
-            curNode = curNode->right;
-        } else {
-            newNode = &curNode->left;
-            curNode = curNode->left;
-        }
+void bt_depths(const bt_t *tree, uint8_t *depths) {
+    if (tree->root == BT_NIL) {
+        return;
     }
-}
-
-bt_t *bt_join(bt_t **tree1, bt_t **tree2) {
-    bt_t *joinedTree = bt_init();
-    joinedTree->count =(*tree1)->count + (*tree2)->count;
-    btdata_t rootData = {'\0', (*tree1)->root->data.freq+(*tree2)->root->data.freq};
-    bt_insert(joinedTree, rootData);
-    if((*tree1)->root->data.freq >= (*tree2)->root->data.freq) {
-        joinedTree->root->right = (*tree1)->root;
-        joinedTree->root->left = (*tree2)->root;
-    } else {
-        joinedTree->root->right = (*tree2)->root;
-        joinedTree->root->left = (*tree1)->root;
+    depths[tree->root] = 0;
+    for (btindex_t i = tree->root + 1; i-- > 0;) {
+        const btnode_t *node = &tree->nodes[i];
+        if (node->left != BT_NIL) {
+            depths[node->left] = depths[i] + 1;
+            depths[node->right] = depths[i] + 1;
+        }
     }
-    free(*tree1);
-    *tree1 = NULL;
-    free(*tree2);
-    *tree2 = NULL;
-    return joinedTree;
 }
@@ -12,76 +12,80 @@
 #include "core.h"
 
 /**
-  Standardized name for btNote structure
+  Number of nodes of the full binary tree with given number of leaves.
 */
-typedef struct btNode btnode_t;
+#define BT_NODES(leaves) (2 * (leaves) - 1)
 
 /**
-  Binary tree structure.
-  Contains info about tree size and it's root.
+  Index of the tree node in the nodes array.
 */
-typedef struct {
-    btnode_t *root;  /**< tree root */
-    uint64_t count;  /**< tree node count */
-} bt_t;
+typedef uint32_t btindex_t;
 
 /**
-  Binary tree node data structure.
-  Contains symbol data.
+  Index of the missing node.
 */
-typedef struct {
-    char symb;      /**< symbol */
-    uint64_t freq;  /**< frequency of occurrence of the symbol */
-} btdata_t;
+#define BT_NIL ((btindex_t)-1)
 
 /**
   Binary tree node structure.
-  Contains node data and pointers to left and right children nodes.
+  Contains node data and indexes of left and right children nodes.
 */
-struct btNode {
-    btdata_t data;    /**< tree node data */
-    btnode_t *left;   /**< pointer to left child */
-    btnode_t *right;  /**< pointer to right child */
-};
+typedef struct {
+    uint64_t freq;    /**< frequency of occurrence of the node symbols */
+    btindex_t left;   /**< index of left child, BT_NIL for leaves */
+    btindex_t right;  /**< index of right child, BT_NIL for leaves */
+    uint16_t symb;    /**< symbol of the leaf */
+} btnode_t;
+
+/**
+  Binary tree structure.
+  Nodes are allocated one after another from the array of the owner, so children always precede their parent.
+*/
+typedef struct {
+    btnode_t *nodes;               /**< nodes arena, at least BT_NODES(leaves) elements */
+    btindex_t count;               /**< tree node count */
+    btindex_t root;                /**< index of the tree root */
+} bt_t;
 
 
 /**
-  @brief Create and initialize binary tree structure
+  @brief Initialize binary tree structure
 
-  @return Pointer to new initialized tree
+  Releases all the nodes of the previous tree at once.
+  @param[out] tree bt_t * Tree to initialize
+  @param[in] nodes btnode_t * Nodes arena
 */
-bt_t *bt_init(void);
+void bt_init(bt_t *tree, btnode_t *nodes);
 
 /**
-  @brief Destroy tree and all of it's nodes
+  @brief Create new leaf node
 
-  Frees all the nodes recursivly.
-  Then frees tree structure.
-  @param[in] tree bt_t ** Tree to destroy
-  @see bt_freeSubtree
+  New node becomes the tree root.
+  @param[in] tree bt_t * Tree
+  @param[in] symb uint16_t Symbol
+  @param[in] freq uint64_t Frequency of occurrence of the symbol
+  @return Index of the new node
 */
-void bt_free(bt_t **tree);
+btindex_t bt_leaf(bt_t *tree, uint16_t symb, uint64_t freq);
 
 /**
-  @brief Insert new element to the tree
+  @brief Unite two subtrees into new one
 
-  Finds place for new element.
-  Tree should be a binary search tree for proper work.
+  Given subtrees root nodes become children of new root, it becomes the tree root.
   @param[in] tree bt_t * Tree
-  @param[in] item btdata_t Item to insert
-  @return 1 if new item is unique, 2 otherwise
+  @param[in] left btindex_t Root of the first subtree
+  @param[in] right btindex_t Root of the second subtree
+  @return Index of the new root
 */
-int bt_insert(bt_t *tree, btdata_t item);
+btindex_t bt_join(bt_t *tree, btindex_t left, btindex_t right);
 
 /**
-  @brief Unite two trees into new one
+  @brief Calculate depth of every node
 
-  Given trees root nodes become older children of new tree root.
-  Given tree structures are freed automatically.
-  @param[in] tree1 bt_t ** First tree
-  @param[in] tree2 bt_t ** Second tree
-  @return Pointer to the new tree
+  Parents are visited before their children in one pass from the root down the array.
+  @param[in] tree bt_t * Tree
+  @param[out] depths uint8_t * Depths of the nodes, tree->count elements
 */
-bt_t *bt_join(bt_t **tree1, bt_t **tree2);
+void bt_depths(const bt_t *tree, uint8_t *depths);
 
 #endif /* end of include guard: BINTREE_H */
@@ -0,0 +1,110 @@
+/**
+  @file checksum.c
+  @brief Block checksums
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#include "checksum.h"
+#include <string.h>
+#include <threads.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CS_SSE42
+#endif
+
+/**
+  Reversed CRC32C polynomial.
+*/
+#define CS_POLY 0x82f63b78u
+
+/**
+  Number of bytes processed at once by the software version.
+*/
+#define CS_SLICES 8
+
+/**
+  Tables of the software version, table k gives CRC of a byte followed by k zero bytes.
+*/
+static uint32_t cs_table[CS_SLICES][256];
+static once_flag cs_tableOnce = ONCE_FLAG_INIT;
+
+/**
+  @brief Fills the software version tables
+*/
+static void cs_initTable(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ CS_POLY : crc >> 1;
+        }
+        cs_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < CS_SLICES; k++) {
+            cs_table[k][i] = (cs_table[k - 1][i] >> 8) ^ cs_table[0][cs_table[k - 1][i] & 0xff];
+        }
+    }
+}
+
+/**
+  @brief Updates checksum with the buffer, eight bytes at a time
+
+  @param[in] crc uint32_t Current inverted checksum
+  @param[in] buf uint8_t * Buffer to checksum
+  @param[in] size size_t Size of the buffer
+  @return Updated inverted checksum
+*/
+static uint32_t cs_crc32cScalar(uint32_t crc, const uint8_t *buf, size_t size) {
+    call_once(&cs_tableOnce, cs_initTable);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint32_t words[2];
+        memcpy(words, buf + i, sizeof(words));
+        uint32_t low = words[0] ^ crc, high = words[1];
+        crc = cs_table[7][low & 0xff] ^ cs_table[6][(low >> 8) & 0xff]
+            ^ cs_table[5][(low >> 16) & 0xff] ^ cs_table[4][low >> 24]
+            ^ cs_table[3][high & 0xff] ^ cs_table[2][(high >> 8) & 0xff]
+            ^ cs_table[1][(high >> 16) & 0xff] ^ cs_table[0][high >> 24];
+    }
+    for (; i < size; i++) {
+        crc = (crc >> 8) ^ cs_table[0][(crc ^ buf[i]) & 0xff];
+    }
+    return crc;
+}
+
+#ifdef CS_SSE42
+/**
+  @brief Updates checksum with the buffer using SSE4.2
+
+  @param[in] crc uint32_t Current inverted checksum
+  @param[in] buf uint8_t * Buffer to checksum
+  @param[in] size size_t Size of the buffer
+  @return Updated inverted checksum
+*/
+__attribute__((target("sse4.2")))
+static uint32_t cs_crc32cSse42(uint32_t crc, const uint8_t *buf, size_t size) {
+    uint64_t crc64 = crc;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; i < size; i++) {
+        crc = _mm_crc32_u8(crc, buf[i]);
+    }
+    return crc;
+}
+#endif
+
+uint32_t cs_crc32c(const uint8_t *buf, size_t size) {
+#ifdef CS_SSE42
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ~cs_crc32cSse42(~0u, buf, size);
+    }
+#endif
+    return ~cs_crc32cScalar(~0u, buf, size);
+}
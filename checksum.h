@@ -0,0 +1,25 @@
+/**
+  @file checksum.h
+  @brief Block checksums
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+  @brief Calculates CRC32C (Castagnoli) checksum of the buffer
+
+  Uses SSE4.2 crc32 instruction if the CPU supports it.
+  @param[in] buf uint8_t * Buffer to checksum
+  @param[in] size size_t Size of the buffer
+  @return Checksum
+*/
+uint32_t cs_crc32c(const uint8_t *buf, size_t size);
+
+#endif /* end of include guard: CHECKSUM_H */
@@ -9,8 +9,116 @@
 #include "core.h"
 #include <string.h>
 #include <stdlib.h>
+#include "batch.h"
 #include "huffman.h"
 
+/**
+  Size of the stdio buffer of the standard streams.
+  Pipes are read and written by large chunks instead of the default buffer size.
+*/
+#define STREAM_BUFFER_SIZE (1 << 20)
+
+/**
+  @brief Parses size with optional K or M suffix
+
+  @param[in] arg char * String to parse
+  @param[out] size uint32_t * Parsed size
+  @return true if the size is valid block size
+*/
+static bool parseBlockSize(char const *arg, uint32_t *size) {
+    char *end = NULL;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if (end == arg) {
+        return false;
+    }
+    if (*end == 'K' || *end == 'k') {
+        value <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        value <<= 20;
+        end++;
+    }
+    if (*end || value < HUFF_MIN_BLOCK_SIZE || value > HUFF_MAX_BLOCK_SIZE) {
+        return false;
+    }
+    *size = (uint32_t)value;
+    return true;
+}
+
+/**
+  @brief Parses range of the original text
+
+  @param[in] arg char * String of OFFSET:LENGTH format
+  @param[out] offset uint64_t * Position of the range
+  @param[out] length uint64_t * Size of the range
+  @return true if the range is valid
+*/
+static bool parseRange(char const *arg, uint64_t *offset, uint64_t *length) {
+    char *end = NULL;
+    if (*arg < '0' || *arg > '9') {
+        return false;
+    }
+    *offset = strtoull(arg, &end, 10);
+    if (*end != ':' || end[1] < '0' || end[1] > '9') {
+        return false;
+    }
+    arg = end + 1;
+    *length = strtoull(arg, &end, 10);
+    return !*end;
+}
+
+/**
+  @brief Opens file, - stands for the standard stream
+
+  Standard streams get large buffer, which should live until the stream is closed.
+  @param[in] path char * Path to the file or -
+  @param[in] mode char * File opening mode
+  @param[in] stdFile FILE * Standard stream used for -
+  @param[out] buf char ** Allocated stream buffer, NULL for other files
+  @return Pointer to the file structure
+*/
+static FILE* openFile(char const *path, char const *mode, FILE *stdFile, char **buf) {
+    *buf = NULL;
+    if (strcmp(path, "-")) {
+        return s_fopen(path, mode);
+    }
+    *buf = (char*)s_malloc(STREAM_BUFFER_SIZE);
+    setvbuf(stdFile, *buf, _IOFBF, STREAM_BUFFER_SIZE);
+    return stdFile;
+}
+
+/**
+  @brief Reads dictionary file
+
+  @param[in] path char * Path to the dictionary
+  @param[out] data uint8_t ** Allocated content of the file
+  @param[out] size size_t * Size of the file
+  @param[out] dict huffdict_t * Dictionary
+*/
+static void loadDict(char const *path, uint8_t **data, size_t *size, huffdict_t *dict) {
+    FILE *file = s_fopen(path, "rb");
+    *size = getFileSize(file);
+    *data = (uint8_t*)s_malloc(*size ? *size : 1);
+    if (fread(*data, 1, *size, file) != *size || readDict(*data, *size, dict) != HUFF_OK) {
+        printError(huff_strerror(HUFF_ERR_DICT));
+        s_exit(EXIT_FAILURE);
+    }
+    fclose(file);
+}
+
+/**
+  @brief Prints estimate of one block
+
+  @param[in] arg uint64_t * Number of the blocks printed before
+  @param[in] block huffestimate_t * Block estimate
+*/
+static void printBlockEstimate(void *arg, const huffestimate_t *block) {
+    uint64_t *blockNum = (uint64_t*)arg;
+    char const *type = block->storedBlocks ? ESTIMATE_STORED : block->repeatedTables ? ESTIMATE_REPEATED : ESTIMATE_NEW_TABLE;
+    printf(ESTIMATE_BLOCK, (unsigned long long)(*blockNum)++, (unsigned long long)block->rawSize,
+           (unsigned long long)block->encodedSize, block->shannonBound, type);
+}
+
 /**
   @brief Application entry point
 
@@ -20,25 +128,200 @@
   @return 0
 */
 int main(int argc, char const *argv[]) {
-    if(argc != 4) {
+    char const *mode = NULL;
+    char const *files[2] = {NULL, NULL};
+    size_t fileCount = 0;
+    bool printStats = false, statsJson = false;
+    bool range = false;
+    char const *batchSource = NULL, *outDir = NULL, *dictPath = NULL;
+    uint64_t rangeOffset = 0, rangeLength = 0;
+    huffopts_t opts;
+    huff_initOpts(&opts);
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "-x") || !strcmp(argv[i], "-t") || !strcmp(argv[i], "--train")
+            || !strcmp(argv[i], "--estimate")) {
+            mode = argv[i];
+        } else if (!strcmp(argv[i], "-B") && i + 1 < argc) {
+            if (!parseBlockSize(argv[++i], &opts.blockSize)) {
+                printError(WRONG_BLOCK_SIZE);
+                exit(0);
+            }
+        } else if (!strcmp(argv[i], "-T") && i + 1 < argc) {
+            char *end = NULL;
+            unsigned long threads = strtoul(argv[++i], &end, 10);
+            if (*end || !threads || threads > HUFF_MAX_THREADS) {
+                printError(WRONG_THREADS);
+                exit(0);
+            }
+            opts.threads = threads;
+        } else if (!strcmp(argv[i], "-S") && i + 1 < argc) {
+            char *end = NULL;
+            unsigned long streams = strtoul(argv[++i], &end, 10);
+            if (*end || !streams || streams > HUFF_MAX_STREAMS) {
+                printError(WRONG_STREAMS);
+                exit(0);
+            }
+            opts.streams = streams;
+        } else if (!strcmp(argv[i], "--max-code-len") && i + 1 < argc) {
+            char *end = NULL;
+            unsigned long len = strtoul(argv[++i], &end, 10);
+            if (*end || len < HUFF_MIN_CODE_LEN || len > HUFF_MAX_CODE_LEN) {
+                printError(WRONG_CODE_LEN);
+                exit(0);
+            }
+            opts.maxCodeLen = len;
+        } else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "order0")) {
+                opts.mode = HUFF_MODE_ORDER0;
+            } else if (!strcmp(argv[i], "ctx1")) {
+                opts.mode = HUFF_MODE_CTX1;
+            } else {
+                printError(WRONG_MODE);
+                exit(0);
+            }
+        } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "8") || !strcmp(argv[i], "16")) {
+                opts.symbolBits = atoi(argv[i]);
+            } else {
+                printError(WRONG_WIDTH);
+                exit(0);
+            }
+        } else if (!strcmp(argv[i], "--range") && i + 1 < argc) {
+            if (!parseRange(argv[++i], &rangeOffset, &rangeLength)) {
+                printError(WRONG_RANGE);
+                exit(0);
+            }
+            range = true;
+        } else if (!strcmp(argv[i], "-D") && i + 1 < argc) {
+            dictPath = argv[++i];
+        } else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+            batchSource = argv[++i];
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            outDir = argv[++i];
+        } else if (!strcmp(argv[i], "--stats") || !strcmp(argv[i], "--stats=json")) {
+            printStats = true;
+            statsJson = argv[i][strlen("--stats")] == '=';
+        } else if (argv[i][0] == '-' && argv[i][1]) {
+            printError(WRONG_ARG);
+            printUsage();
+            exit(0);
+        } else if (fileCount < 2) {
+            files[fileCount++] = argv[i];
+        } else {
+            fileCount++;
+        }
+    }
+    if (mode && !strcmp(mode, "--train") && (dictPath || range || batchSource || outDir)) {
+        printError(WRONG_TRAIN_ARGS);
+        exit(0);
+    }
+    // 16-bit symbols have no context tables and no dictionaries
+    if (opts.symbolBits == 16 && (opts.mode != HUFF_MODE_ORDER0 || dictPath || batchSource || outDir
+                                  || (mode && !strcmp(mode, "--train")))) {
+        printError(WRONG_WIDTH_ARGS);
+        exit(0);
+    }
+    // dictionary tables are built for its own coding mode
+    uint8_t *dictData = NULL;
+    size_t dictSize = 0;
+    huffdict_t dict;
+    if (dictPath) {
+        loadDict(dictPath, &dictData, &dictSize, &dict);
+        opts.mode = dict.mode;
+    }
+    // testing decodes the input and estimating only counts its symbols, without any output file
+    bool test = mode && !strcmp(mode, "-t");
+    bool estimate = mode && !strcmp(mode, "--estimate");
+    if (batchSource || outDir) {
+        if (!mode || test || estimate || !batchSource || !outDir || fileCount || range) {
+            printError(WRONG_BATCH_ARGS);
+            printUsage();
+            exit(0);
+        }
+        size_t failed = batch_run(batchSource, outDir, !strcmp(mode, "-c"), &opts, dictData, dictSize);
+        free(dictData);
+        return failed ? EXIT_FAILURE : 0;
+    }
+    if (test && fileCount != 1) {
+        printError(WRONG_TEST_ARGS);
+        printUsage();
+        exit(0);
+    }
+    if (estimate && fileCount != 1) {
+        printError(WRONG_ESTIMATE_ARGS);
+        printUsage();
+        exit(0);
+    }
+    if(!mode || (!test && !estimate && fileCount != 2)) {
         printError(WRONG_ARG_NUM);
         printUsage();
         exit(0);
     }
+    if (range && strcmp(mode, "-x")) {
+        printError(RANGE_NOT_DECODING);
+        exit(0);
+    }
 
-    FILE *input = s_fopen(argv[1], "rb");
-    FILE *output = s_fopen(argv[3], "wb");
+    char *inputBuf, *outputBuf = NULL;
+    FILE *input = openFile(files[0], "rb", stdin, &inputBuf);
+    // decoder maps the output, so it should be readable too
+    FILE *output = test || estimate ? NULL : openFile(files[1], !strcmp(mode, "-c") ? "wb" : "w+b", stdout, &outputBuf);
 
-    if (!strcmp(argv[2], "-c")) {
-        encodeFile(input, output);
-    } else if (!strcmp(argv[2], "-x")) {
-        decodeFile(input, output);
+    huffstats_t stats = {0};
+    huffstats_t *statsPtr = printStats ? &stats : NULL;
+    const huffdict_t *dictPtr = dictPath ? &dict : NULL;
+    huff_status_t status;
+    huffestimate_t total;
+    uint64_t blockNum = 0;
+    if (estimate) {
+        printf(ESTIMATE_HEADER);
+        status = estimateFile(input, &opts, dictPtr, printBlockEstimate, &blockNum, &total);
+    } else if (!strcmp(mode, "--train")) {
+        status = trainDict(input, output, &opts);
+    } else if (!strcmp(mode, "-c")) {
+        status = encodeFile(input, output, &opts, dictPtr, statsPtr);
+    } else if (range) {
+        status = decodeFileRange(input, output, &opts, dictPtr, rangeOffset, rangeLength, statsPtr);
     } else {
-        printError(WRONG_ARG);
-        printUsage();
+        status = decodeFile(input, output, &opts, dictPtr, statsPtr);
+    }
+    if (status == HUFF_ERR_EMPTY) {
+        printInfo(huff_strerror(status));
+    } else if (status != HUFF_OK) {
+        // failed coding or testing is reported by the exit code to the scripts running it
+        printError(huff_strerror(status));
+        s_exit(EXIT_FAILURE);
+    } else if (test) {
+        printInfo(TEST_PASSED);
+    }
+    if (estimate && status == HUFF_OK) {
+        // empty input has no ratio
+        double scale = total.rawSize ? 1.0 / total.rawSize : 0;
+        printf(ESTIMATE_REPORT, (unsigned long long)total.rawSize, (unsigned long long)total.encodedSize,
+               total.encodedSize * scale, total.shannonBound, total.shannonBound * scale,
+               (unsigned long long)total.blocks, (unsigned long long)total.storedBlocks, (unsigned long long)total.repeatedTables);
+    }
+    if (printStats) {
+#ifdef HUFF_STATS
+        // statistics don't mix with the coded stream written to stdout
+        st_print(&stats, statsJson, output == stdout ? stderr : stdout);
+#else
+        (void)statsJson;
+        printInfo(STATS_DISABLED);
+#endif
     }
 
     fclose(input);
-    fclose(output);
+    // buffered data of pipes is written only now
+    if (output && fclose(output)) {
+        printError(huff_strerror(HUFF_ERR_IO));
+        s_exit(EXIT_FAILURE);
+    }
+    free(inputBuf);
+    free(outputBuf);
+    free(dictData);
     return 0;
 }
@@ -0,0 +1,138 @@
+/**
+  @file fileio.c
+  @brief Memory mapped file input and output with stdio fallback
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#define _POSIX_C_SOURCE 200809L
+#include "fileio.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FILEIO_MMAP
+#endif
+
+void fin_open(fin_t *in, FILE *file) {
+    in->file = file;
+    in->map = NULL;
+    in->mapSize = 0;
+    in->pos = 0;
+#ifdef FILEIO_MMAP
+    struct stat st;
+    off_t start = ftello(file);
+    if (start < 0 || fstat(fileno(file), &st) || !S_ISREG(st.st_mode) || st.st_size <= start) {
+        return;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+    in->map = (const uint8_t*)map;
+    in->mapSize = st.st_size;
+    in->pos = start;
+#endif
+}
+
+const uint8_t* fin_read(fin_t *in, size_t size, uint8_t *buf, size_t *got) {
+    if (!in->map) {
+        *got = fread(buf, 1, size, in->file);
+        return buf;
+    }
+    *got = fin_mapped(in) < size ? fin_mapped(in) : size;
+    const uint8_t *data = in->map + in->pos;
+    in->pos += *got;
+    return data;
+}
+
+uint64_t fin_mapped(const fin_t *in) {
+    return in->map ? in->mapSize - in->pos : 0;
+}
+
+void fin_prefetch(const fin_t *in, size_t size) {
+#ifdef FILEIO_MMAP
+    if (!in->map || !fin_mapped(in)) {
+        return;
+    }
+    // advice works on whole pages
+    uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t start = in->pos / pageSize * pageSize;
+    uint64_t end = fin_mapped(in) < size ? in->mapSize : in->pos + size;
+    posix_madvise((void*)(in->map + start), end - start, POSIX_MADV_WILLNEED);
+#else
+    (void)in;
+    (void)size;
+#endif
+}
+
+void fin_close(fin_t *in) {
+#ifdef FILEIO_MMAP
+    if (in->map) {
+        munmap((void*)in->map, in->mapSize);
+        // leave stdio position where reading stopped
+        fseeko(in->file, in->pos, SEEK_SET);
+    }
+#endif
+    in->map = NULL;
+}
+
+void fout_open(fout_t *out, FILE *file, uint64_t size) {
+    out->file = file;
+    out->map = NULL;
+    out->mapSize = 0;
+    out->pos = 0;
+#ifdef FILEIO_MMAP
+    if (!file) {
+        return;
+    }
+    struct stat st;
+    int mode = fcntl(fileno(file), F_GETFL);
+    if (size == UINT64_MAX || !size || (off_t)size < 0 || mode < 0 || (mode & O_ACCMODE) != O_RDWR
+        || fstat(fileno(file), &st) || !S_ISREG(st.st_mode) || ftello(file) != 0) {
+        return;
+    }
+    fflush(file);
+    if (ftruncate(fileno(file), size)) {
+        return;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(file), 0);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+    out->map = (uint8_t*)map;
+    out->mapSize = size;
+#endif
+}
+
+uint8_t* fout_reserve(fout_t *out, size_t size, uint8_t *buf) {
+    if (!out->map) {
+        return buf;
+    } else if (out->mapSize - out->pos < size) {
+        return NULL;
+    }
+    uint8_t *data = out->map + out->pos;
+    out->pos += size;
+    return data;
+}
+
+bool fout_write(fout_t *out, const uint8_t *data, size_t size) {
+    return out->map || !out->file || fwrite(data, 1, size, out->file) == size;
+}
+
+void fout_close(fout_t *out) {
+#ifdef FILEIO_MMAP
+    if (out->map) {
+        munmap(out->map, out->mapSize);
+        if (out->pos < out->mapSize && ftruncate(fileno(out->file), out->pos)) {
+            printError(FTRUNCATE_FAILED);
+        }
+        fseeko(out->file, out->pos, SEEK_SET);
+    }
+#endif
+    out->map = NULL;
+}
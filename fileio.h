@@ -0,0 +1,124 @@
+/**
+  @file fileio.h
+  @brief Memory mapped file input and output with stdio fallback
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include "core.h"
+
+/**
+  Input file structure.
+  Regular files are mapped to memory and read without copying,
+  other files are read to the caller buffers.
+*/
+typedef struct {
+    FILE *file;           /**< input file */
+    const uint8_t *map;   /**< mapped file content, NULL if the file isn't mapped */
+    uint64_t mapSize;     /**< size of the mapped file */
+    uint64_t pos;         /**< current position in the mapped file */
+} fin_t;
+
+/**
+  Output file structure.
+  Regular files of known size are mapped to memory and written in place,
+  other files are written from the caller buffers.
+*/
+typedef struct {
+    FILE *file;           /**< output file */
+    uint8_t *map;         /**< mapped file content, NULL if the file isn't mapped */
+    uint64_t mapSize;     /**< size of the mapped file */
+    uint64_t pos;         /**< current position in the mapped file */
+} fout_t;
+
+/**
+  @brief Open input file
+
+  Maps the file from the current position to the end if it is a nonempty regular file.
+  @param[out] in fin_t * Input structure to initialize
+  @param[in] file FILE * File opened for reading
+*/
+void fin_open(fin_t *in, FILE *file);
+
+/**
+  @brief Read data from the input file
+
+  @param[in] in fin_t * Input file
+  @param[in] size size_t Number of bytes to read
+  @param[in] buf uint8_t * Buffer for unmapped file data, at least size bytes
+  @param[out] got size_t * Number of bytes actually read
+  @return Pointer to the data read, either to the file mapping or to the buffer
+*/
+const uint8_t* fin_read(fin_t *in, size_t size, uint8_t *buf, size_t *got);
+
+/**
+  @brief Get number of bytes left in the mapped file
+
+  @param[in] in fin_t * Input file
+  @return Number of bytes after the current position, 0 if the file isn't mapped
+*/
+uint64_t fin_mapped(const fin_t *in);
+
+/**
+  @brief Ask the system to read ahead the mapped input
+
+  Pages of the next data are read in the background, so coding doesn't wait for them.
+  Does nothing if the file isn't mapped.
+  @param[in] in fin_t * Input file
+  @param[in] size size_t Number of bytes after the current position to read ahead
+*/
+void fin_prefetch(const fin_t *in, size_t size);
+
+/**
+  @brief Unmap input file
+
+  File itself stays open.
+  @param[in] in fin_t * Input file
+*/
+void fin_close(fin_t *in);
+
+/**
+  @brief Open output file
+
+  Sets the file size and maps it if it is a regular file opened for reading and writing, and size is known.
+  @param[out] out fout_t * Output structure to initialize
+  @param[in] file FILE * File opened for writing, NULL discards the output
+  @param[in] size uint64_t Final size of the output, UINT64_MAX if unknown
+*/
+void fout_open(fout_t *out, FILE *file, uint64_t size);
+
+/**
+  @brief Reserve place for the next output data
+
+  @param[in] out fout_t * Output file
+  @param[in] size size_t Number of bytes to reserve
+  @param[in] buf uint8_t * Buffer to use if the file isn't mapped, at least size bytes
+  @return Pointer to the place for the data, either in the file mapping or the buffer,
+          NULL if the data doesn't fit into the mapped file size
+*/
+uint8_t* fout_reserve(fout_t *out, size_t size, uint8_t *buf);
+
+/**
+  @brief Write reserved data to the output file
+
+  Data reserved in the file mapping is already in place, buffers are written with stdio.
+  @param[in] out fout_t * Output file
+  @param[in] data uint8_t * Pointer returned by fout_reserve
+  @param[in] size size_t Number of bytes to write
+  @return false if the data can't be written
+*/
+bool fout_write(fout_t *out, const uint8_t *data, size_t size);
+
+/**
+  @brief Unmap output file
+
+  Truncates mapped file to the written size. File itself stays open.
+  @param[in] out fout_t * Output file
+*/
+void fout_close(fout_t *out);
+
+#endif /* end of include guard: FILEIO_H */
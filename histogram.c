@@ -0,0 +1,135 @@
+/**
+  @file histogram.c
+  @brief Byte and 16-bit symbol frequency counting
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#include "histogram.h"
+#include <string.h>
+#include "core.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HIST_AVX2
+#endif
+
+/**
+  Number of sub-histograms.
+  Equal neighbour bytes increment different counters, so increments don't wait for each other.
+*/
+#define HIST_TABLES 4
+
+/**
+  Maximal number of bytes counted before sub-histograms are merged.
+  Keeps 32-bit counters from overflowing.
+*/
+#define HIST_CHUNK ((size_t)1 << 30)
+
+/**
+  @brief Counts bytes of one 64-bit word into sub-histograms
+
+  @param[in] word uint64_t Eight bytes to count
+  @param[in,out] counts uint32_t[][] Sub-histograms
+*/
+static inline void hist_countWord(uint64_t word, uint32_t counts[HIST_TABLES][HIST_SIZE]) {
+    counts[0][(uint8_t)word]++;
+    counts[1][(uint8_t)(word >> 8)]++;
+    counts[2][(uint8_t)(word >> 16)]++;
+    counts[3][(uint8_t)(word >> 24)]++;
+    counts[0][(uint8_t)(word >> 32)]++;
+    counts[1][(uint8_t)(word >> 40)]++;
+    counts[2][(uint8_t)(word >> 48)]++;
+    counts[3][(uint8_t)(word >> 56)]++;
+}
+
+/**
+  @brief Counts bytes into sub-histograms
+
+  @param[in] buf uint8_t * Buffer to count bytes of
+  @param[in] size size_t Size of the buffer
+  @param[in,out] counts uint32_t[][] Sub-histograms
+*/
+static void hist_countScalar(const uint8_t *buf, size_t size, uint32_t counts[HIST_TABLES][HIST_SIZE]) {
+    size_t i = 0;
+    for (; i + 2 * sizeof(uint64_t) <= size; i += 2 * sizeof(uint64_t)) {
+        uint64_t words[2];
+        memcpy(words, buf + i, sizeof(words));
+        hist_countWord(words[0], counts);
+        hist_countWord(words[1], counts);
+    }
+    for (; i < size; i++) {
+        counts[i % HIST_TABLES][buf[i]]++;
+    }
+}
+
+#ifdef HIST_AVX2
+/**
+  @brief Counts bytes into sub-histograms, detecting runs with AVX2
+
+  Only runs are accelerated: every 32 bytes are compared with their first byte,
+  and a run is counted with one addition instead of 32 increments of the same counter.
+  Other bytes are counted by the scalar sub-histograms, as byte counting itself has no vector form without scatter.
+  @param[in] buf uint8_t * Buffer to count bytes of
+  @param[in] size size_t Size of the buffer
+  @param[in,out] counts uint32_t[][] Sub-histograms
+*/
+__attribute__((target("avx2")))
+static void hist_countRunsAvx2(const uint8_t *buf, size_t size, uint32_t counts[HIST_TABLES][HIST_SIZE]) {
+    size_t i = 0;
+    for (; i + sizeof(__m256i) <= size; i += sizeof(__m256i)) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i first = _mm256_set1_epi8((char)buf[i]);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, first)) == -1) {
+            counts[0][buf[i]] += sizeof(__m256i);
+        } else {
+            uint64_t words[4];
+            _mm256_storeu_si256((__m256i*)words, bytes);
+            hist_countWord(words[0], counts);
+            hist_countWord(words[1], counts);
+            hist_countWord(words[2], counts);
+            hist_countWord(words[3], counts);
+        }
+    }
+    hist_countScalar(buf + i, size - i, counts);
+}
+#endif
+
+void hist_count(const uint8_t *buf, size_t size, FILESIZE_T *freqTable) {
+#ifdef HIST_AVX2
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    uint32_t counts[HIST_TABLES][HIST_SIZE];
+    for (size_t offset = 0; offset < size; offset += HIST_CHUNK) {
+        size_t chunk = size - offset < HIST_CHUNK ? size - offset : HIST_CHUNK;
+        memset(counts, 0, sizeof(counts));
+#ifdef HIST_AVX2
+        if (avx2) {
+            hist_countRunsAvx2(buf + offset, chunk, counts);
+        } else {
+            hist_countScalar(buf + offset, chunk, counts);
+        }
+#else
+        hist_countScalar(buf + offset, chunk, counts);
+#endif
+        for (size_t i = 0; i < HIST_SIZE; i++) {
+            freqTable[i] += (FILESIZE_T)counts[0][i] + counts[1][i] + counts[2][i] + counts[3][i];
+        }
+    }
+}
+
+void hist_count16(const uint16_t *buf, size_t size, FILESIZE_T *freqTable) {
+    // sub-histograms of 16-bit symbols don't fit into cache, so they are counted into one table
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) / sizeof(uint16_t) <= size; i += sizeof(uint64_t) / sizeof(uint16_t)) {
+        uint64_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        freqTable[(uint16_t)word]++;
+        freqTable[(uint16_t)(word >> 16)]++;
+        freqTable[(uint16_t)(word >> 32)]++;
+        freqTable[(uint16_t)(word >> 48)]++;
+    }
+    for (; i < size; i++) {
+        freqTable[buf[i]]++;
+    }
+}
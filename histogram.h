@@ -0,0 +1,46 @@
+/**
+  @file histogram.h
+  @brief Byte and 16-bit symbol frequency counting
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stdsafe.h"
+
+/**
+  Number of different byte values.
+*/
+#define HIST_SIZE 256
+/**
+  Number of different 16-bit symbol values.
+*/
+#define HIST16_SIZE 65536
+
+/**
+  @brief Counts byte frequencies of the buffer
+
+  Adds counts to the given table, so it should be zeroed before the first call.
+  Runs of one byte are detected with AVX2 if the CPU supports it, other bytes are counted by scalar code.
+  @param[in] buf uint8_t * Buffer to count bytes of
+  @param[in] size size_t Size of the buffer
+  @param[in,out] freqTable FILESIZE_T * Frequency table of HIST_SIZE elements
+*/
+void hist_count(const uint8_t *buf, size_t size, FILESIZE_T *freqTable);
+
+/**
+  @brief Counts 16-bit symbol frequencies of the buffer
+
+  Adds counts to the given table, so it should be zeroed before the first call.
+  @param[in] buf uint16_t * Buffer to count symbols of
+  @param[in] size size_t Number of symbols in the buffer
+  @param[in,out] freqTable FILESIZE_T * Frequency table of HIST16_SIZE elements
+*/
+void hist_count16(const uint16_t *buf, size_t size, FILESIZE_T *freqTable);
+
+#endif /* end of include guard: HISTOGRAM_H */
@@ -7,265 +7,2423 @@
   @license This file is released under the GNU Public License
 */
 #include "huffman.h"
-#include <limits.h>
-#include "btree.h"
+#include <math.h>
+#include <string.h>
+#include "bitio.h"
+#include "checksum.h"
 #include "core.h"
-#include "pqueue.h"
+#include "fileio.h"
+#include "histogram.h"
+#include "thpool.h"
 
 
-#define INBUF_T uint8_t
-#define INBUF_T_SIZE (sizeof(INBUF_T)*CHAR_BIT)
-#define INBUF_T_LIM (1 << INBUF_T_SIZE)
-#define INBUF_T_MAX (INBUF_T_LIM - 1)
-#define OUTBUF_T __uint64_t
-#define OUTBUF_T_SIZE (sizeof(OUTBUF_T)*CHAR_BIT)
-#define OUTBUF_T_LIM (1 << OUTBUF_T_SIZE)
-#define OUTBUF_T_MAX (OUTBUF_T_LIM - 1)
+/**
+  Maximal size of the code lengths table stored in front of every encoded block.
+  Every symbol takes at most 2*INBUF_T_SIZE+1 bits of the gap and 6 bits of the length,
+  and only symbols far apart take long gaps.
+*/
+#define BLOCK_TABLE_BOUND (INBUF_T_LIM * 3 + 8)
+
+/**
+  Relative loss of compression accepted to repeat the previous code table.
+*/
+#define TABLE_REUSE_SLACK 0.001
+
+/**
+  Minimal gain of the coded block in bits per symbol, blocks of higher entropy are stored as is.
+  Such a gain is mostly eaten by the code redundancy and the table, and isn't worth the decoding time.
+*/
+#define STORED_MIN_GAIN 0.02
+
+/**
+  Estimated size of one code lengths table entry in bits, used to weigh tables of context clusters.
+*/
+#define CTX_SYMBOL_BITS 6
+
+/**
+  Number of context clustering passes, every pass moves contexts to their cheapest clusters.
+*/
+#define CTX_CLUSTER_PASSES 4
+
+/**
+  Number of blocks read at once for every thread.
+  More than one block per thread evens out threads load.
+*/
+#define BLOCKS_PER_THREAD 2
+
+/**
+  Block coding job.
+  Contains buffers of one block processed by the thread pool.
+*/
+typedef struct {
+    blockheader_t block;     /**< block header */
+    const INBUF_T *text;     /**< original text of the block, either in the mapped input or in textBuf */
+    INBUF_T *decoded;        /**< place for the decoded text, either in the mapped output or in textBuf */
+    INBUF_T *textBuf;        /**< text buffer */
+    const uint8_t *payload;  /**< encoded block, either in the mapped input or in payloadBuf */
+    uint8_t *payloadBuf;     /**< encoded block buffer */
+    blockscratch_t *scratch;  /**< tables scratch memory */
+    const huffopts_t *opts;  /**< coding options */
+    huff_status_t status;    /**< result of the block decoding */
+    huffestimate_t estimate;  /**< estimate of the block, used instead of encoding it */
+} blockjob_t;
+
+/**
+  Number of block batches in the coding pipeline.
+  One batch is read, one is coded and one is written at the same time.
+*/
+#define PIPELINE_BATCHES 3
 
 /**
-  Huffman table element.
+  Batch of blocks passing through the coding pipeline.
 */
 typedef struct {
-    uint64_t code;  /**< Huffman code of the symbol */
-    uint8_t len;    /**< Code length */
-} htdata_t;
+    blockjob_t *jobs;      /**< jobs of the batch blocks */
+    size_t count;          /**< number of the blocks read */
+    bool eof;              /**< the last block of the file is read */
+    huff_status_t status;  /**< error of the reader stage */
+} blockbatch_t;
+
+/**
+  File coding pipeline.
+  Reader and writer stages run on their own threads around the thread pool coding the batch between them.
+*/
+typedef struct {
+    fin_t in;                  /**< input file */
+    FILE *output;              /**< output file of the encoder */
+    fout_t out;                /**< output file of the decoder */
+    const huffopts_t *opts;    /**< coding options of the blocks */
+    uint32_t blockSize;        /**< maximal size of the text block */
+    size_t payloadBound;       /**< maximal size of the encoded block */
+    blockbatch_t batches[PIPELINE_BATCHES];  /**< ring of the batches */
+    size_t jobCount;           /**< number of jobs in every batch */
+    blockbatch_t *readBatch;   /**< batch of the current reader job */
+    blockbatch_t *writeBatch;  /**< batch of the current writer job */
+    reftable_t *ref;           /**< reference table, chosen by the encoder coding stage or read by the decoder reader stage */
+    blockindex_t index;        /**< index of the written blocks */
+    uint64_t filePos;          /**< position of the next written block */
+    FILESIZE_T decodedSize;    /**< size of the written text */
+    huff_status_t writeStatus; /**< error of the writer stage */
+    huffstats_t *stats;        /**< total statistics, may be NULL; reader adds only bytesIn and writer only bytesOut */
+    huffstats_t readStats;     /**< timing of the reader stage */
+    huffstats_t writeStats;    /**< timing of the writer stage and statistics of the written blocks */
+    huffestimate_t *estimate;  /**< estimate of the file, summed by the writer stage of the estimator */
+    estimatewriter_t estimateWrite;  /**< receiver of the block estimates, may be NULL */
+    void *estimateArg;         /**< argument of the block estimates receiver */
+} pipeline_t;
+
+/**
+  Coding stage of the pipeline, codes the batch on the pool.
+*/
+typedef void (*batchcoder_t)(pipeline_t *p, blockbatch_t *batch, thpool_t *pool);
+
+/**
+  @brief Generates huffman table using huffman tree
+
+  Code length of every symbol is the depth of its leaf, codes themselves are assigned later.
+  @param[in,out] scratch codescratch_t * Scratch memory with the huffman tree, gets depths of its nodes
+  @param[out] huffmanTable htdata_t * Pointer to the huffman table
+*/
+static void bttoht(codescratch_t *scratch, htdata_t *huffmanTable) {
+    const bt_t *tree = &scratch->tree;
+    memset(huffmanTable, 0, INBUF_T_LIM * sizeof(htdata_t));
+    bt_depths(tree, scratch->depths);
+    for (btindex_t i = 0; i < tree->count; i++) {
+        if (tree->nodes[i].left == BT_NIL) {
+            huffmanTable[tree->nodes[i].symb].len = scratch->depths[i];
+        }
+    }
+}
+
+void getFreqTable(const INBUF_T *inBuf, FILESIZE_T inBuf_size, FILESIZE_T *freqTable) {
+    memset(freqTable, 0, INBUF_T_LIM * sizeof(FILESIZE_T));
+#if HUFF_SYMBOL_BITS == 16
+    hist_count16(inBuf, inBuf_size, freqTable);
+#else
+    hist_count(inBuf, inBuf_size, freqTable);
+#endif
+}
 
 /**
-  @brief Recursively generates huffman table using huffman tree root
+  @brief Replaces huffman codes with canonical ones
 
-  @param[in] subtreeRoot btnode_t * Pointer to the huffman tree root
-  @param[in] huffmanTable htdata_t * Pointer to the huffman table
-  @param[in] code uint64_t Huffman code of the previos node of the tree
-  @param[in] codeLen uint8_t Level of the previos node of the tree
-  @return Pointer to the generated huffman table
+  Canonical codes of the same length are consecutive numbers assigned in symbol order,
+  and shorter codes precede longer ones. So code table is fully defined by code lengths.
+  @param[in,out] codeTable htdata_t * Pointer to the huffman code table with code lengths set
 */
-htdata_t* btnodetoht(const btnode_t * const subtreeRoot, htdata_t *huffmanTable, uint64_t code, uint8_t codeLen) {
-    if (subtreeRoot->left) {
-        btnodetoht(subtreeRoot->left, huffmanTable, (code<<1)+0, codeLen+1u);
+static void assignCanonicalCodes(htdata_t *codeTable) {
+    uint64_t count[CODE_LEN_LIM + 1] = {0};
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        count[codeTable[i].len]++;
     }
-    if (subtreeRoot->right) {
-        btnodetoht(subtreeRoot->right, huffmanTable, (code<<1)+1, codeLen+1u);
+    count[0] = 0;
+
+    uint64_t nextCode[CODE_LEN_LIM + 1] = {0};
+    for (size_t len = 1; len <= CODE_LEN_LIM; len++) {
+        nextCode[len] = (nextCode[len - 1] + count[len - 1]) << 1;
     }
-    if (!subtreeRoot->left && !subtreeRoot->right){
-        huffmanTable[(uint8_t)subtreeRoot->data.symb].code = code;
-        huffmanTable[(uint8_t)subtreeRoot->data.symb].len = codeLen;
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        if (codeTable[i].len) {
+            codeTable[i].code = nextCode[codeTable[i].len]++;
+        }
     }
-    return huffmanTable;
 }
 
 /**
-  @brief Generates huffman table using huffman tree
+  Width of the radix sort digit.
+*/
+#define SORT_DIGIT_BITS 8
+#define SORT_DIGIT_LIM (1 << SORT_DIGIT_BITS)
+
+/**
+  @brief Sorts present symbols by frequency, then by symbol value
 
-  Allocates memory for the table.
-  Generates table.
-  Destroys huffman tree automatically
-  @param[in] tree bt_t * Pointer to the huffman tree
-  @see btnodetoht
-  @return Pointer to the generated huffman table
+  Least significant digit radix sort. Symbols are collected in symbol order and every pass is stable,
+  and passes stop at the highest nonzero digit of the maximal frequency, so small blocks take one or two passes.
+  @param[in] freqTable FILESIZE_T * Pointer to the symbol frequency table
+  @param[in,out] scratch codescratch_t * Scratch memory, gets sorted present symbols in leaves
+  @return Number of present symbols
 */
-htdata_t* bttoht(bt_t** tree) {
-    htdata_t *huffmanTable = (htdata_t*)s_calloc(256, sizeof(htdata_t));
-    htdata_t *ht = btnodetoht((*tree)->root, huffmanTable, 0, 0);
-    bt_free(tree);
-    return ht;
+static size_t sortSymbFreq(const FILESIZE_T *freqTable, codescratch_t *scratch) {
+    symbfreq_t *leaves = scratch->leaves;
+    size_t leafCount = 0;
+    FILESIZE_T maxFreq = 0;
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        if (freqTable[i]) {
+            leaves[leafCount++] = (symbfreq_t){freqTable[i], i};
+            maxFreq |= freqTable[i];
+        }
+    }
+
+    symbfreq_t *src = leaves, *dst = scratch->sortBuf;
+    for (unsigned shift = 0; shift < sizeof(FILESIZE_T) * CHAR_BIT && maxFreq >> shift; shift += SORT_DIGIT_BITS) {
+        size_t offset[SORT_DIGIT_LIM] = {0};
+        for (size_t i = 0; i < leafCount; i++) {
+            offset[(src[i].freq >> shift) & (SORT_DIGIT_LIM - 1)]++;
+        }
+        for (size_t digit = 0, sum = 0; digit < SORT_DIGIT_LIM; digit++) {
+            size_t count = offset[digit];
+            offset[digit] = sum;
+            sum += count;
+        }
+        for (size_t i = 0; i < leafCount; i++) {
+            dst[offset[(src[i].freq >> shift) & (SORT_DIGIT_LIM - 1)]++] = src[i];
+        }
+        symbfreq_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != leaves) {
+        memcpy(leaves, src, leafCount * sizeof(symbfreq_t));
+    }
+    return leafCount;
 }
 
 /**
-  @brief Generates Huffman tree using priority queue with symbol frequencies
+  @brief Generates huffman tree using symbols sorted by frequency
 
-  Destroys priority queue automatically
-  @param[in] pq pq_t * Pointer to the priority queue
-  @return Pointer to the generated huffman tree
+  Two-queue method: leaves are taken in sorted order, and joined nodes are created in nondecreasing
+  weight order, so both queues are sorted and the two lightest nodes are always at their fronts.
+  Leaves win ties, which keeps the tree shallower.
+  @param[in,out] scratch codescratch_t * Scratch memory with present symbols sorted by frequency, gets the huffman tree
+  @param[in] leafCount size_t Number of present symbols
 */
-bt_t* pqtobt(pq_t **pq) {
-    while (true) {
-        bt_t *subtree1 = (bt_t*)pq_pop(*pq);
-        bt_t *subtree2 = (bt_t*)pq_pop(*pq);
-        if (!subtree1) {
-            pq_free(pq);
-            return NULL;
-        } else if (!subtree2) {
-            return subtree1;
-        } else {
-            bt_t *joinedTree = bt_join(&subtree1, &subtree2);
-            pq_push(*pq, joinedTree, joinedTree->root->data.freq);
+static void buildTree(codescratch_t *scratch, size_t leafCount) {
+    const symbfreq_t *leaves = scratch->leaves;
+    bt_t *tree = &scratch->tree;
+    bt_init(tree, scratch->nodes);
+    for (size_t i = 0; i < leafCount; i++) {
+        bt_leaf(tree, leaves[i].symb, leaves[i].freq);
+    }
+    btindex_t leaf = 0, node = leafCount;
+    for (size_t i = 1; i < leafCount; i++) {
+        btindex_t subtrees[2];
+        for (size_t j = 0; j < 2; j++) {
+            if (leaf < leafCount && (node >= tree->count || tree->nodes[leaf].freq <= tree->nodes[node].freq)) {
+                subtrees[j] = leaf++;
+            } else {
+                subtrees[j] = node++;
+            }
         }
+        bt_join(tree, subtrees[0], subtrees[1]);
     }
 }
 
 /**
-  @brief Generates symbol frequency table
+  @brief Generates optimal code lengths not longer than maxLen using package-merge algorithm
 
-  @param[in] inBuf INBUF_T * Pointer to the text buffer
-  @param[in] inBuf_size FILESIZE_T Size of the text buffer
-  @return Pointer to the generated symbol frequency table
+  Every list level contains leaves merged with packages of pairs of the previous level items.
+  The first 2n-2 items of the last level define code lengths: every leaf gets one bit
+  for every level it is taken at, and packages taken at one level take twice as many items at the previous one.
+  @param[in,out] scratch codescratch_t * Scratch memory with present symbols sorted by frequency
+  @param[in] leafCount size_t Number of present symbols, at least 2
+  @param[out] codeTable htdata_t * Pointer to the huffman code table to write lengths to
+  @param[in] maxLen uint8_t Code length limit, 2^maxLen should not be less than number of present symbols
 */
-FILESIZE_T* getFreqTable(INBUF_T *inBuf, FILESIZE_T inBuf_size) {
-    FILESIZE_T *freqTable = (FILESIZE_T*)s_calloc(INBUF_T_LIM, sizeof(FILESIZE_T));
-    for (FILESIZE_T i = 0; i < inBuf_size; i++) {
-        freqTable[inBuf[i]]++;
+static void limitCodeLengths(codescratch_t *scratch, size_t leafCount, htdata_t *codeTable, uint8_t maxLen) {
+    const symbfreq_t *leaves = scratch->leaves;
+    for (size_t i = 0; i < leafCount; i++) {
+        codeTable[leaves[i].symb].len = 0;
+    }
+
+    // weights of the previous and current level items, leaf flags of every level items
+    FILESIZE_T (*weights)[2 * INBUF_T_LIM] = scratch->weights;
+    bool (*isLeaf)[2 * INBUF_T_LIM] = scratch->isLeaf;
+    size_t itemCount[HUFF_MAX_CODE_LEN];
+
+    // the deepest level contains only leaves
+    for (size_t i = 0; i < leafCount; i++) {
+        weights[0][i] = leaves[i].freq;
+        isLeaf[maxLen - 1][i] = true;
+    }
+    itemCount[maxLen - 1] = leafCount;
+
+    for (size_t level = maxLen - 1, cur = 1; level > 0; level--, cur ^= 1) {
+        const FILESIZE_T *prev = weights[cur ^ 1];
+        size_t packageCount = itemCount[level] / 2;
+        size_t leaf = 0, package = 0, count = 0;
+        while (leaf < leafCount || package < packageCount) {
+            FILESIZE_T packageWeight = package < packageCount ? prev[2 * package] + prev[2 * package + 1] : 0;
+            if (package >= packageCount || (leaf < leafCount && leaves[leaf].freq <= packageWeight)) {
+                weights[cur][count] = leaves[leaf++].freq;
+                isLeaf[level - 1][count++] = true;
+            } else {
+                weights[cur][count] = packageWeight;
+                isLeaf[level - 1][count++] = false;
+                package++;
+            }
+        }
+        itemCount[level - 1] = count;
+    }
+
+    // unwind taken items from the top level down to the leaves level
+    size_t taken = 2 * leafCount - 2;
+    for (size_t level = 0; level < maxLen && taken; level++) {
+        size_t leafTaken = 0;
+        for (size_t i = 0; i < taken; i++) {
+            leafTaken += isLeaf[level][i];
+        }
+        for (size_t i = 0; i < leafTaken; i++) {
+            codeTable[leaves[i].symb].len++;
+        }
+        taken = 2 * (taken - leafTaken);
+    }
+}
+
+FILESIZE_T getCodeTable(const FILESIZE_T *freqTable, htdata_t *huffmanTable, uint8_t maxLen, codescratch_t *scratch) {
+    // generate huffman tree from symbols sorted by frequency
+    size_t leafCount = sortSymbFreq(freqTable, scratch);
+    const symbfreq_t *leaves = scratch->leaves;
+    buildTree(scratch, leafCount);
+
+    // generate code table from huffman tree
+    bttoht(scratch, huffmanTable);
+
+    // single symbol gets one bit code, so every present symbol has nonzero length
+    if (leafCount == 1) {
+        huffmanTable[leaves[0].symb].len = 1;
+    }
+    // large alphabet may not fit into codes of the limit length
+    while (((size_t)1 << maxLen) < leafCount) {
+        maxLen++;
+    }
+    bool tooLong = false;
+    for (size_t i = 0; i < leafCount; i++) {
+        tooLong |= huffmanTable[leaves[i].symb].len > maxLen;
+    }
+    if (tooLong) {
+        limitCodeLengths(scratch, leafCount, huffmanTable, maxLen);
+    }
+    assignCanonicalCodes(huffmanTable);
+
+    // calculate encoded text size
+    FILESIZE_T outBuf_bits = 0;
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        outBuf_bits += freqTable[i] * huffmanTable[i].len;
+    }
+    return outBuf_bits;
+}
+
+/**
+  @brief Calculates size of the jump table in front of multistream block
+
+  Jump table contains sizes of all the bitstreams except the last one in bytes.
+  @param[in] streams uint8_t Number of bitstreams
+  @return Size of the jump table
+*/
+static inline size_t jumpTableSize(uint8_t streams) {
+    return (streams - 1) * sizeof(uint32_t);
+}
+
+size_t blockPayloadBound(size_t inBuf_size, const huffopts_t *opts) {
+    size_t tableBound = BLOCK_TABLE_BOUND;
+    if (IS_CTX1(opts->mode)) {
+        tableBound = CTX_MAX_TABLES * BLOCK_TABLE_BOUND + CTX_LIM * CTX_TABLES_BITS / CHAR_BIT + 1;
+    }
+    // block type byte, every bitstream is padded to the byte, and the last flush stores the whole word
+    return 1 + jumpTableSize(opts->streams) + tableBound + inBuf_size * INBUF_T_SIZE / CHAR_BIT + opts->streams + sizeof(uint64_t);
+}
+
+void countBlockSymbols(const INBUF_T *inBuf, uint32_t inBuf_size, const huffopts_t *opts, blockscratch_t *scratch) {
+    if (!IS_CTX1(opts->mode)) {
+        getFreqTable(inBuf, inBuf_size, scratch->freqTable);
+        return;
+    }
+    memset(scratch->ctxFreqTable, 0, sizeof(scratch->ctxFreqTable));
+    FILESIZE_T segment = (inBuf_size + opts->streams - 1) / opts->streams;
+    for (FILESIZE_T first = 0; first < inBuf_size; first += segment) {
+        FILESIZE_T last = first + segment < inBuf_size ? first + segment : inBuf_size;
+        // every bitstream is decoded independently, so its first symbol has zero context
+        INBUF_T prev = 0;
+        for (FILESIZE_T i = first; i < last; i++) {
+            scratch->ctxFreqTable[prev][inBuf[i]]++;
+            prev = inBuf[i];
+        }
+    }
+}
+
+/**
+  @brief Writes Elias gamma code of the number
+
+  @param[in] bw bitwriter_t * Writer
+  @param[in] value uint32_t Positive number to write
+*/
+static void writeGamma(bitwriter_t *bw, uint32_t value) {
+    uint8_t bits = 0;
+    while (value >> (bits + 1)) {
+        bits++;
+    }
+    // leading zeros are written as a part of the code
+    bw_write(bw, value, 2 * bits + 1);
+}
+
+/**
+  @brief Writes code lengths table
+
+  Table contains number of present symbols, width of the length fields,
+  and then for every present symbol gap from the previous one in Elias gamma code followed by code length.
+  @param[in] bw bitwriter_t * Writer
+  @param[in] codeTable htdata_t * Pointer to the huffman code table
+*/
+static void writeCodeLengths(bitwriter_t *bw, const htdata_t *codeTable) {
+    uint32_t symbCount = 0;
+    uint8_t maxLen = 0;
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        if (codeTable[i].len) {
+            symbCount++;
+            maxLen = codeTable[i].len > maxLen ? codeTable[i].len : maxLen;
+        }
+    }
+    uint8_t lenBits = 0;
+    while ((maxLen - 1) >> lenBits) {
+        lenBits++;
+    }
+
+    bw_write(bw, symbCount - 1, INBUF_T_SIZE + 1);
+    bw_write(bw, lenBits, 3);
+    bw_flush(bw);
+
+    size_t prevSymb = 0;
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        if (codeTable[i].len) {
+            writeGamma(bw, i - prevSymb + 1);
+            if (lenBits) {
+                bw_write(bw, codeTable[i].len - 1u, lenBits);
+            }
+            bw_flush(bw);
+            prevSymb = i + 1;
+        }
+    }
+}
+
+/**
+  @brief Calculates width of the context map entries
+
+  @param[in] tableCount uint8_t Number of code tables
+  @return Width in bits
+*/
+static inline uint8_t ctxMapBits(uint8_t tableCount) {
+    return tableCount > 1 ? 32 - __builtin_clz(tableCount - 1u) : 0;
+}
+
+/**
+  @brief Writes code tables of the block
+
+  HUFF_MODE_CTX1 tables are preceded by their number and the table of every context.
+  @param[in] bw bitwriter_t * Writer
+  @param[in] scratch blockscratch_t * Scratch memory with the block code tables
+  @param[in] mode uint8_t Coding mode
+*/
+static void writeCodeTables(bitwriter_t *bw, const blockscratch_t *scratch, uint8_t mode) {
+    if (IS_CTX1(mode)) {
+        bw_write(bw, scratch->tableCount - 1u, CTX_TABLES_BITS);
+        bw_flush(bw);
+        uint8_t mapBits = ctxMapBits(scratch->tableCount);
+        for (size_t ctx = 0; ctx < CTX_LIM && mapBits; ctx++) {
+            bw_write(bw, scratch->ctxMap[ctx], mapBits);
+            bw_flush(bw);
+        }
+    }
+    for (uint8_t table = 0; table < scratch->tableCount; table++) {
+        writeCodeLengths(bw, scratch->codeTable[table]);
+    }
+}
+
+/**
+  @brief Calculates size of the code lengths table written by writeCodeLengths
+
+  @param[in] codeTable htdata_t * Pointer to the huffman code table
+  @return Size of the table in bits
+*/
+static FILESIZE_T codeLengthsBits(const htdata_t *codeTable) {
+    uint8_t maxLen = 0;
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        maxLen = codeTable[i].len > maxLen ? codeTable[i].len : maxLen;
+    }
+    uint8_t lenBits = 0;
+    while ((maxLen - 1) >> lenBits) {
+        lenBits++;
+    }
+
+    FILESIZE_T bits = INBUF_T_SIZE + 1 + 3;
+    size_t prevSymb = 0;
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        if (codeTable[i].len) {
+            bits += 2 * (31 - __builtin_clz(i - prevSymb + 1)) + 1 + lenBits;
+            prevSymb = i + 1;
+        }
     }
-    return freqTable;
+    return bits;
 }
 
 /**
-  @brief Generates huffman code table using symbol frequency table
+  @brief Calculates size of the code tables written by writeCodeTables
+
+  @param[in] ref reftable_t * Code tables
+  @param[in] mode uint8_t Coding mode
+  @return Size of the tables in bits
+*/
+static FILESIZE_T codeTablesBits(const reftable_t *ref, uint8_t mode) {
+    FILESIZE_T bits = 0;
+    if (IS_CTX1(mode)) {
+        bits += CTX_TABLES_BITS + CTX_LIM * ctxMapBits(ref->tableCount);
+    }
+    for (uint8_t table = 0; table < ref->tableCount; table++) {
+        bits += codeLengthsBits(ref->codeTable[table]);
+    }
+    return bits;
+}
+
+/**
+  @brief Calculates entropy of the block
 
-  Also calculates size of the encoded text and writes it to the outBuf_size.
   @param[in] freqTable FILESIZE_T * Pointer to the symbol frequency table
-  @param[out] outBuf_size FILESIZE_T * Pointer to the size of the encoded text
-  @return Pointer to the generated huffman code table
+  @param[out] symbCount FILESIZE_T * Number of symbols in the block
+  @return Shannon bound of the encoded block size in bits
 */
-htdata_t* getCodeTable(FILESIZE_T *freqTable, FILESIZE_T *outBuf_size) {
-    // generate huffman tree using priority queue and symbol frequency table
-    pq_t *pq = pq_init(INBUF_T_LIM);
+static double blockEntropy(const FILESIZE_T *freqTable, FILESIZE_T *symbCount) {
+    FILESIZE_T total = 0;
+    double sum = 0;
     for (size_t i = 0; i < INBUF_T_LIM; i++) {
         if (freqTable[i]) {
-            bt_t *symbTree = bt_init();
-            btdata_t symbData = {(char)i, freqTable[i]};
-            bt_insert(symbTree, symbData);
-            pq_push(pq, (void*)symbTree, freqTable[i]);
+            total += freqTable[i];
+            sum += freqTable[i] * log2((double)freqTable[i]);
         }
     }
-    bt_t *freqTree = pqtobt(&pq);
+    *symbCount = total;
+    return total ? total * log2((double)total) - sum : 0;
+}
 
-    // generate code table from huffman tree
-    htdata_t *huffmanTable = bttoht(&freqTree);
+/**
+  @brief Calculates cost of every symbol in the cluster
+
+  Absent symbols are counted as a half occurrence, so contexts with new symbols are penalized but not banned.
+  @param[in] freqTable FILESIZE_T * Pointer to the cluster frequency table
+  @param[out] bitCost double * Cost of every symbol in bits
+*/
+static void clusterBitCost(const FILESIZE_T *freqTable, double *bitCost) {
+    FILESIZE_T total = 0;
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        total += freqTable[i];
+    }
+    double totalBits = log2(total + 0.5 * INBUF_T_LIM);
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        bitCost[i] = totalBits - log2(freqTable[i] + 0.5);
+    }
+}
+
+/**
+  @brief Calculates cost of the context in the cluster
 
-    // calculate output file size
-    *outBuf_size = 0;
-    for (uint16_t i = 0; i < 256; i++) {
-        *outBuf_size += (freqTable[i]) * (huffmanTable[i].len);
+  @param[in] freqTable FILESIZE_T * Pointer to the context frequency table
+  @param[in] bitCost double * Cost of every symbol in the cluster
+  @return Cost in bits
+*/
+static double contextCost(const FILESIZE_T *freqTable, const double *bitCost) {
+    double cost = 0;
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        cost += freqTable[i] * bitCost[i];
     }
-    *outBuf_size /= OUTBUF_T_SIZE;
-    (*outBuf_size)++;
+    return cost;
+}
+
+/**
+  @brief Estimates size of the cluster code and its table
 
-    return huffmanTable;
+  @param[in] freqTable FILESIZE_T * Pointer to the cluster frequency table
+  @return Size in bits
+*/
+static double clusterBits(const FILESIZE_T *freqTable) {
+    FILESIZE_T symbCount;
+    double bits = blockEntropy(freqTable, &symbCount);
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        bits += freqTable[i] ? CTX_SYMBOL_BITS : 0;
+    }
+    return bits;
 }
 
 /**
-  @brief Writes one symbol code to the buffer
+  @brief Clusters contexts of the block
 
-  @param[out] buf OUTBUF_T * Buffer for encoded text
-  @param[out] bufIndex FILESIZE_T * Number of the current element in the buffer
-  @param[out] bufSpace int16_t * Pointer to the number of free bits in the current element of the buffer
-  @param[in] symb htdata_t * Pointer to the symbol huffman code
+  Seeds are picked as the contexts worst coded by the already picked clusters,
+  then contexts are moved to their cheapest clusters for a few passes,
+  and the clusters are merged while it makes the code with tables shorter.
+  @param[in,out] scratch blockscratch_t * Scratch memory with the context frequency tables, gets the context map
+  @param[out] clusterFreq FILESIZE_T * Frequency table of every cluster
+  @return Number of clusters
 */
-static inline void writeCodeToBuf(OUTBUF_T *buf, FILESIZE_T *bufIndex, int16_t *bufSpace, htdata_t *symb) {
-    *bufSpace -= symb->len;
-    if(*bufSpace >= 0) {
-        buf[*bufIndex] = (buf[*bufIndex] << symb->len) | symb->code;
-        if (!bufSpace) {
-            bufSpace += OUTBUF_T_SIZE;
-            (*bufIndex)++;
+static uint8_t clusterContexts(blockscratch_t *scratch, FILESIZE_T (*clusterFreq)[INBUF_T_LIM]) {
+    FILESIZE_T (*ctxFreq)[INBUF_T_LIM] = scratch->ctxFreqTable;
+    uint8_t *ctxMap = scratch->ctxMap;
+    double bitCost[CTX_MAX_TABLES][INBUF_T_LIM];
+    double ctxEntropy[CTX_LIM];
+    double excess[CTX_LIM];
+    INBUF_T used[CTX_LIM];
+    size_t usedCount = 0;
+
+    // farthest point seeding, starting from the context with the most symbols
+    size_t seed = 0;
+    FILESIZE_T seedCount = 0;
+    for (size_t ctx = 0; ctx < CTX_LIM; ctx++) {
+        FILESIZE_T symbCount;
+        ctxEntropy[ctx] = blockEntropy(ctxFreq[ctx], &symbCount);
+        excess[ctx] = 0;
+        ctxMap[ctx] = 0;
+        if (symbCount) {
+            used[usedCount++] = (INBUF_T)ctx;
+            excess[ctx] = INFINITY;
+        }
+        if (symbCount > seedCount) {
+            seedCount = symbCount;
+            seed = ctx;
+        }
+    }
+    uint8_t count = 0;
+    while (count < CTX_MAX_TABLES && count < usedCount) {
+        clusterBitCost(ctxFreq[seed], bitCost[count]);
+        ctxMap[seed] = count;
+        excess[seed] = 0;
+        size_t farthest = seed;
+        for (size_t i = 0; i < usedCount; i++) {
+            INBUF_T ctx = used[i];
+            double cost = contextCost(ctxFreq[ctx], bitCost[count]) - ctxEntropy[ctx];
+            if (cost < excess[ctx]) {
+                excess[ctx] = cost;
+                ctxMap[ctx] = count;
+            }
+            farthest = excess[ctx] > excess[farthest] ? ctx : farthest;
+        }
+        count++;
+        // context which loses less than its own table would take doesn't need a new cluster
+        if (excess[farthest] < clusterBits(ctxFreq[farthest]) - ctxEntropy[farthest]) {
+            break;
+        }
+        seed = farthest;
+    }
+
+    for (unsigned pass = 0; pass < CTX_CLUSTER_PASSES; pass++) {
+        memset(clusterFreq, 0, CTX_MAX_TABLES * sizeof(clusterFreq[0]));
+        for (size_t i = 0; i < usedCount; i++) {
+            for (size_t symb = 0; symb < INBUF_T_LIM; symb++) {
+                clusterFreq[ctxMap[used[i]]][symb] += ctxFreq[used[i]][symb];
+            }
+        }
+        if (pass + 1 == CTX_CLUSTER_PASSES) {
+            break;
+        }
+        for (uint8_t cluster = 0; cluster < count; cluster++) {
+            clusterBitCost(clusterFreq[cluster], bitCost[cluster]);
+        }
+        for (size_t i = 0; i < usedCount; i++) {
+            double best = INFINITY;
+            for (uint8_t cluster = 0; cluster < count; cluster++) {
+                double cost = contextCost(ctxFreq[used[i]], bitCost[cluster]);
+                if (cost < best) {
+                    best = cost;
+                    ctxMap[used[i]] = cluster;
+                }
+            }
+        }
+    }
+
+    // empty clusters are dropped, then the closest clusters are merged while it pays off
+    double bits[CTX_MAX_TABLES];
+    uint8_t newCount = 0;
+    uint8_t renumber[CTX_MAX_TABLES];
+    for (uint8_t cluster = 0; cluster < count; cluster++) {
+        FILESIZE_T symbCount = 0;
+        for (size_t i = 0; i < INBUF_T_LIM; i++) {
+            symbCount += clusterFreq[cluster][i];
+        }
+        renumber[cluster] = newCount;
+        if (symbCount) {
+            memmove(clusterFreq[newCount], clusterFreq[cluster], sizeof(clusterFreq[0]));
+            bits[newCount] = clusterBits(clusterFreq[newCount]);
+            newCount++;
+        }
+    }
+    for (size_t i = 0; i < usedCount; i++) {
+        ctxMap[used[i]] = renumber[ctxMap[used[i]]];
+    }
+    count = newCount;
+    while (count > 1) {
+        FILESIZE_T merged[INBUF_T_LIM];
+        double mapGain = CTX_LIM * (double)(ctxMapBits(count) - ctxMapBits(count - 1));
+        double bestGain = 0, bestBits = 0;
+        uint8_t bestA = 0, bestB = 0;
+        for (uint8_t a = 0; a < count; a++) {
+            for (uint8_t b = a + 1; b < count; b++) {
+                for (size_t i = 0; i < INBUF_T_LIM; i++) {
+                    merged[i] = clusterFreq[a][i] + clusterFreq[b][i];
+                }
+                double mergedBits = clusterBits(merged);
+                double gain = bits[a] + bits[b] - mergedBits + mapGain;
+                if (gain > bestGain) {
+                    bestGain = gain;
+                    bestBits = mergedBits;
+                    bestA = a;
+                    bestB = b;
+                }
+            }
+        }
+        if (!bestB) {
+            break;
+        }
+        // cluster b is merged into a, the last cluster takes place of b
+        for (size_t i = 0; i < INBUF_T_LIM; i++) {
+            clusterFreq[bestA][i] += clusterFreq[bestB][i];
+        }
+        bits[bestA] = bestBits;
+        count--;
+        memcpy(clusterFreq[bestB], clusterFreq[count], sizeof(clusterFreq[0]));
+        bits[bestB] = bits[count];
+        for (size_t i = 0; i < usedCount; i++) {
+            uint8_t *cluster = &ctxMap[used[i]];
+            *cluster = *cluster == bestB ? bestA : *cluster == count ? bestB : *cluster;
         }
-    } else {
-        buf[*bufIndex] = (buf[*bufIndex] << (symb->len + *bufSpace)) | (symb->code >> -*bufSpace);
-        buf[++(*bufIndex)] |= (symb->code & ((1 << -*bufSpace) - 1));
-        *bufSpace += OUTBUF_T_SIZE;
     }
+    return count;
 }
 
-void encodeFile(FILE * const input, FILE * const output) {
-    // printInfo(ENCODING_START);
+/**
+  @brief Copies the reference table to the block scratch memory unless it is there already
 
-    // copy input file data to RAM
-    FILESIZE_T inBuf_size = getFileSize(input);
-    if (!inBuf_size) {
-        printInfo(FILE_IS_EMPTY);
-        s_exit(0);
+  @param[in] ref reftable_t * Reference table
+  @param[out] scratch blockscratch_t * Scratch memory
+*/
+static void copyRefTable(const reftable_t *ref, blockscratch_t *scratch) {
+    if (scratch->tableId != ref->id) {
+        memcpy(scratch->codeTable, ref->codeTable, ref->tableCount * sizeof(ref->codeTable[0]));
+        memcpy(scratch->ctxMap, ref->ctxMap, sizeof(scratch->ctxMap));
+        scratch->tableCount = ref->tableCount;
+        scratch->tableId = ref->id;
+        scratch->tableBits = ref->tableBits;
     }
-    INBUF_T *inBuf = (INBUF_T*)s_malloc(inBuf_size * sizeof(INBUF_T));
-    fread(inBuf, inBuf_size, sizeof(INBUF_T), input);
+}
 
-    FILESIZE_T *freqTable = getFreqTable(inBuf, inBuf_size);
-    FILESIZE_T outBuf_size = 0;
-    htdata_t *codeTable = getCodeTable(freqTable, &outBuf_size);
+/**
+  @brief Checks whether the block consists of one symbol
 
-    fwrite(freqTable, sizeof(FILESIZE_T), INBUF_T_LIM, output);
-    free(freqTable);
+  In HUFF_MODE_CTX1 such a symbol is counted in the zero context as the first symbol of every bitstream
+  and in its own context after that.
+  @param[in] freqTable FILESIZE_T * Frequency table of the block, of every context in HUFF_MODE_CTX1
+  @param[in] ctx1 bool Frequencies are counted for every context
+  @param[in] symbCount FILESIZE_T Number of symbols in the block
+  @return true if the block is a run of one symbol
+*/
+static bool isRunBlock(const FILESIZE_T *freqTable, bool ctx1, FILESIZE_T symbCount) {
+    size_t symb = 0;
+    while (symb < INBUF_T_MAX && !freqTable[symb]) {
+        symb++;
+    }
+    FILESIZE_T count = freqTable[symb];
+    if (ctx1 && symb) {
+        count += freqTable[symb * INBUF_T_LIM + symb];
+    }
+    return count == symbCount;
+}
 
-    OUTBUF_T *outBuf = (OUTBUF_T*)s_malloc(outBuf_size*sizeof(OUTBUF_T));
-    FILESIZE_T outBuf_index = 0;
-    int16_t bufSpace = OUTBUF_T_SIZE;
+/**
+  @brief Builds new reference table from the block frequencies
 
-    // encoding
-    for (FILESIZE_T inBuf_index = 0; inBuf_index < inBuf_size; inBuf_index++) {
-        writeCodeToBuf(outBuf, &outBuf_index, &bufSpace, codeTable + inBuf[inBuf_index]);
+  @param[in,out] ref reftable_t * Reference table to replace
+  @param[in] opts huffopts_t * Encoder options
+  @param[in,out] scratch blockscratch_t * Scratch memory with the block frequency tables
+  @return Size of the block text encoded with the new table in bits
+*/
+static FILESIZE_T buildRefTable(reftable_t *ref, const huffopts_t *opts, blockscratch_t *scratch) {
+    FILESIZE_T bits = 0;
+    if (IS_CTX1(opts->mode)) {
+        FILESIZE_T clusterFreq[CTX_MAX_TABLES][INBUF_T_LIM];
+        ref->tableCount = clusterContexts(scratch, clusterFreq);
+        memcpy(ref->ctxMap, scratch->ctxMap, sizeof(ref->ctxMap));
+        for (uint8_t table = 0; table < ref->tableCount; table++) {
+            bits += getCodeTable(clusterFreq[table], ref->codeTable[table], opts->maxCodeLen, &ref->build);
+        }
+    } else {
+        ref->tableCount = 1;
+        memset(ref->ctxMap, 0, sizeof(ref->ctxMap));
+        bits = getCodeTable(scratch->freqTable, ref->codeTable[0], opts->maxCodeLen, &ref->build);
+    }
+    ref->id = ++ref->lastId;
+    ref->tableBits = codeTablesBits(ref, opts->mode);
+    return bits;
+}
+
+void selectCodeTable(reftable_t *ref, const huffopts_t *opts, blockscratch_t *scratch) {
+    STATS_START(timer);
+    // order-0 block is a single context
+    bool ctx1 = IS_CTX1(opts->mode);
+    const FILESIZE_T *freqTable = ctx1 ? scratch->ctxFreqTable[0] : scratch->freqTable;
+    size_t ctxCount = ctx1 ? CTX_LIM : 1;
+    FILESIZE_T symbCount = 0;
+    double entropy = 0;
+    for (size_t ctx = 0; ctx < ctxCount; ctx++) {
+        FILESIZE_T ctxSymbCount;
+        entropy += blockEntropy(freqTable + ctx * INBUF_T_LIM, &ctxSymbCount);
+        symbCount += ctxSymbCount;
+    }
+    scratch->entropy = entropy;
+
+    // every present symbol should have a code in the repeated table
+    scratch->repeat = ref->id != 0;
+    FILESIZE_T cost = 0;
+    for (size_t ctx = 0; ctx < ctxCount && scratch->repeat; ctx++) {
+        const FILESIZE_T *ctxFreq = freqTable + ctx * INBUF_T_LIM;
+        const htdata_t *codeTable = ref->codeTable[ref->ctxMap[ctx]];
+        for (size_t i = 0; i < INBUF_T_LIM && scratch->repeat; i++) {
+            scratch->repeat = !ctxFreq[i] || codeTable[i].len;
+            cost += ctxFreq[i] * codeTable[i].len;
+        }
+    }
+    if (scratch->repeat) {
+        double estimate = entropy + ref->redundancy * symbCount + ref->tableBits;
+        scratch->repeat = cost <= estimate * (1 + TABLE_REUSE_SLACK);
+    }
+
+    // runs and blocks which don't shrink skip the table, and the next blocks still can repeat the reference one;
+    // new order-0 table counts too, as the table of a large alphabet may take more than the code saves
+    double newBits = ctx1 || scratch->repeat ? entropy : clusterBits(freqTable);
+    scratch->type = BLOCK_CODED;
+    if (isRunBlock(freqTable, ctx1, symbCount)) {
+        scratch->type = BLOCK_RUN;
+    } else if (newBits >= symbCount * (INBUF_T_SIZE - STORED_MIN_GAIN) || (scratch->repeat && cost >= symbCount * INBUF_T_SIZE)) {
+        scratch->type = BLOCK_STORED;
+    }
+    if (scratch->type != BLOCK_CODED) {
+        scratch->repeat = true;
+        STATS_LAP(&scratch->stats, ST_TABLE, timer);
+        STATS_ADD(&scratch->stats, storedBlocks, 1);
+        return;
     }
-    outBuf[outBuf_index] <<= bufSpace;
 
-    fwrite(&bufSpace, sizeof(bufSpace), 1, output);
-    fwrite(outBuf, sizeof(OUTBUF_T), outBuf_index+1, output);
+    if (!scratch->repeat) {
+        FILESIZE_T bits = buildRefTable(ref, opts, scratch);
+        ref->redundancy = symbCount ? (bits - entropy) / symbCount : 0;
+    }
+    copyRefTable(ref, scratch);
+    STATS_LAP(&scratch->stats, ST_TABLE, timer);
+    STATS_ADD(&scratch->stats, repeatedTables, scratch->repeat);
+}
 
-    free(codeTable);
-    free(inBuf);
-    free(outBuf);
+void repeatRefTable(const reftable_t *ref, blockscratch_t *scratch) {
+    scratch->type = BLOCK_CODED;
+    scratch->repeat = true;
+    copyRefTable(ref, scratch);
 }
 
-void decodeFile(FILE * const input, FILE * const output) {
-    // printInfo(DECODING_START);
+/**
+  @brief Reads code lengths table written by writeCodeLengths
 
-    // read freqTable from file
-    FILESIZE_T *freqTable = (FILESIZE_T*)s_malloc(INBUF_T_LIM*sizeof(FILESIZE_T));
-    fread(freqTable, INBUF_T_LIM, sizeof(FILESIZE_T), input);
+  Checks that the lengths form a prefix code.
+  @param[in] br bitreader_t * Reader positioned at the table
+  @param[in] inBuf_bits FILESIZE_T Position of the bitstream end
+  @param[out] codeTable htdata_t * Pointer to the huffman code table to fill lengths of
+  @return true if the table is valid
+*/
+static bool readCodeLengths(bitreader_t *br, FILESIZE_T inBuf_bits, htdata_t *codeTable) {
+    memset(codeTable, 0, INBUF_T_LIM * sizeof(htdata_t));
+    size_t symbCount = br_read(br, INBUF_T_SIZE + 1) + 1;
+    uint8_t lenBits = br_read(br, 3);
 
-    // calculate size of original text
-    FILESIZE_T outBuf_size = 0;
-    for (size_t i = 0; i < INBUF_T_LIM; i++) {
-        outBuf_size += freqTable[i];
+    // Kraft sum of the codes scaled by 2^CODE_LEN_LIM
+    uint64_t kraft = 0;
+    size_t symb = 0;
+    for (size_t i = 0; i < symbCount; i++) {
+        unsigned zeros = __builtin_clzll(br_peek(br) | 1);
+        if (zeros > INBUF_T_SIZE) {
+            return false;
+        }
+        symb += br_read(br, 2 * zeros + 1) - 1;
+        uint8_t len = br_read(br, lenBits) + 1;
+        if (symb >= INBUF_T_LIM || len > CODE_LEN_LIM || br->pos > inBuf_bits) {
+            return false;
+        }
+        codeTable[symb++].len = len;
+        kraft += (uint64_t)1 << (CODE_LEN_LIM - len);
     }
-    INBUF_T *outBuf = (INBUF_T*)s_malloc(outBuf_size * sizeof(INBUF_T));
+    return kraft <= ((uint64_t)1 << CODE_LEN_LIM);
+}
+
+/**
+  @brief Builds decoding lookup table using canonical huffman code table
 
-    // read number of free bytes in the end of the file
-    int16_t bufSpace = 0;
-    fread(&bufSpace, 1, sizeof(bufSpace), input);
+  Every code not longer than DECODE_TABLE_BITS fills all the table entries starting with it.
+  @param[out] dtable dtable_t * Pointer to the decoding table
+  @param[in] codeTable htdata_t * Pointer to the canonical huffman code table
+*/
+static void buildDecodeTable(dtable_t *dtable, const htdata_t *codeTable) {
+    memset(dtable->fast, 0, sizeof(dtable->fast));
+    memset(dtable->count, 0, sizeof(dtable->count));
+    dtable->maxLen = 0;
+    for (size_t i = 0; i < INBUF_T_LIM; i++) {
+        dtable->count[codeTable[i].len]++;
+        dtable->maxLen = codeTable[i].len > dtable->maxLen ? codeTable[i].len : dtable->maxLen;
+    }
+    dtable->count[0] = 0;
 
-    // read encoded text from the file
-    FILESIZE_T inBuf_size = (getFileSize(input) - sizeof(FILESIZE_T)*INBUF_T_LIM - sizeof(bufSpace)) / sizeof(OUTBUF_T);
-    OUTBUF_T *inBuf = (OUTBUF_T*)s_malloc(inBuf_size * sizeof(OUTBUF_T));
-    fread(inBuf, inBuf_size, sizeof(OUTBUF_T), input);
+    uint64_t code = 0;
+    uint32_t offset = 0;
+    for (size_t len = 1; len <= CODE_LEN_LIM; len++) {
+        code = (code + (len > 1 ? dtable->count[len - 1] : 0)) << 1;
+        dtable->firstCode[len] = code;
+        dtable->offset[len] = offset;
+        offset += dtable->count[len];
+    }
 
-    // generate huffman tree using priority queue and symbol frequency table
-    pq_t *pq = pq_init(INBUF_T_LIM);
+    uint32_t next[CODE_LEN_LIM + 1];
+    memcpy(next, dtable->offset, sizeof(next));
     for (size_t i = 0; i < INBUF_T_LIM; i++) {
-        if (freqTable[i]) {
-            bt_t *symbTree = bt_init();
-            btdata_t symbData = {(char)i, freqTable[i]};
-            bt_insert(symbTree, symbData);
-            pq_push(pq, (void*)symbTree, freqTable[i]);
+        uint8_t len = codeTable[i].len;
+        if (!len) {
+            continue;
+        }
+        dtable->symbs[next[len]++] = (INBUF_T)i;
+        if (len <= DECODE_TABLE_BITS) {
+            size_t first = codeTable[i].code << (DECODE_TABLE_BITS - len);
+            size_t last = first + ((size_t)1 << (DECODE_TABLE_BITS - len));
+            for (size_t j = first; j < last; j++) {
+                dtable->fast[j].symb = (INBUF_T)i;
+                dtable->fast[j].len = len;
+            }
         }
     }
-    bt_t *freqTree = pqtobt(&pq);
+}
 
-    FILESIZE_T data_size = inBuf_size * OUTBUF_T_SIZE - bufSpace;
-    FILESIZE_T outBuf_index = 0;
-    FILESIZE_T inBuf_index = 0;
-    int8_t curBuf_curBit = OUTBUF_T_SIZE - 1;
-    btnode_t *curNode = freqTree->root;
+/**
+  @brief Decodes one symbol with code longer than DECODE_TABLE_BITS
 
-    for (FILESIZE_T data_index = 0; data_index < data_size; data_index++) {
-        if ((inBuf[inBuf_index] >> curBuf_curBit) & 1U) {
-            curNode = curNode->right;
-        } else {
-            curNode = curNode->left;
-        }
-        if (!((bool)curNode->left | (bool)curNode->right)) {
-            outBuf[outBuf_index++] = curNode->data.symb;
-            curNode = freqTree->root;
+  Codes of every length are consecutive, and prefixes of longer codes are greater than all of them.
+  @param[in] dtable dtable_t * Pointer to the decoding table
+  @param[in] bits uint64_t Next bits of the encoded text
+  @param[out] symb INBUF_T * Decoded symbol
+  @return Length of the decoded symbol code, 0 if no code matches
+*/
+static uint8_t decodeLongCode(const dtable_t *dtable, uint64_t bits, INBUF_T *symb) {
+    for (uint8_t len = DECODE_TABLE_BITS + 1; len <= dtable->maxLen; len++) {
+        uint64_t index = (bits >> (OUTBUF_T_SIZE - len)) - dtable->firstCode[len];
+        if (index < dtable->count[len]) {
+            *symb = dtable->symbs[dtable->offset[len] + index];
+            return len;
         }
-        if (!curBuf_curBit) {
-            curBuf_curBit = OUTBUF_T_SIZE - 1;
-            inBuf_index++;
-        } else {
-            curBuf_curBit--;
+    }
+    return 0;
+}
+
+/**
+  @brief Encodes symbols into one bitstream
+
+  @param[in] bw bitwriter_t * Writer
+  @param[in] inBuf INBUF_T * Pointer to the symbols
+  @param[in] inBuf_size FILESIZE_T Number of symbols
+  @param[in] ctxTables htdata_t ** Code table of every previous symbol
+  @param[in] batch unsigned Number of codes written between flushes, their total length can't exceed BW_FLUSH_BITS
+  @param[in] ctx bool Code table is chosen by the previous symbol, otherwise the first one is used
+*/
+static inline __attribute__((always_inline)) void encodeStream(bitwriter_t *bw, const INBUF_T *inBuf, FILESIZE_T inBuf_size,
+                                                                const htdata_t * const *ctxTables, unsigned batch, bool ctx) {
+    const htdata_t *codeTable = ctxTables[0];
+    INBUF_T prev = 0;
+    FILESIZE_T inBuf_index = 0;
+    for (; inBuf_index + batch <= inBuf_size; inBuf_index += batch) {
+        for (unsigned i = 0; i < batch; i++) {
+            INBUF_T symb = inBuf[inBuf_index + i];
+            const htdata_t *code = (ctx ? ctxTables[prev] : codeTable) + symb;
+            bw_write(bw, code->code, code->len);
+            prev = symb;
         }
+        bw_flush(bw);
     }
+    for (; inBuf_index < inBuf_size; inBuf_index++) {
+        INBUF_T symb = inBuf[inBuf_index];
+        const htdata_t *code = (ctx ? ctxTables[prev] : codeTable) + symb;
+        bw_write(bw, code->code, code->len);
+        prev = symb;
+    }
+}
 
-    fwrite(outBuf, sizeof(INBUF_T), outBuf_size, output);
+/**
+  @brief Encodes symbols into one bitstream with the batch size fitting the code length
 
-    bt_free(&freqTree);
-    free(inBuf);
-    free(outBuf);
-    free(freqTable);
+  @param[in] bw bitwriter_t * Writer
+  @param[in] inBuf INBUF_T * Pointer to the symbols
+  @param[in] inBuf_size FILESIZE_T Number of symbols
+  @param[in] ctxTables htdata_t ** Code table of every previous symbol
+  @param[in] maxLen uint8_t Maximal code length
+  @param[in] ctx bool Code table is chosen by the previous symbol
+*/
+static inline __attribute__((always_inline)) void encodeStreamBatched(bitwriter_t *bw, const INBUF_T *inBuf, FILESIZE_T inBuf_size,
+                                                                       const htdata_t * const *ctxTables, uint8_t maxLen, bool ctx) {
+    // as many codes as fit into the accumulator are written between flushes
+    if (maxLen <= BW_FLUSH_BITS / 4) {
+        encodeStream(bw, inBuf, inBuf_size, ctxTables, 4, ctx);
+    } else if (maxLen <= BW_FLUSH_BITS / 3) {
+        encodeStream(bw, inBuf, inBuf_size, ctxTables, 3, ctx);
+    } else if (maxLen <= BW_FLUSH_BITS / 2) {
+        encodeStream(bw, inBuf, inBuf_size, ctxTables, 2, ctx);
+    } else {
+        encodeStream(bw, inBuf, inBuf_size, ctxTables, 1, ctx);
+    }
+}
+
+size_t encodeBlock(const INBUF_T *inBuf, uint32_t inBuf_size, uint8_t *payload, const huffopts_t *opts, blockscratch_t *scratch) {
+    STATS_START(timer);
+    *payload++ = scratch->type;
+    if (scratch->type != BLOCK_CODED) {
+        // run keeps only its symbol
+        size_t text_size = (scratch->type == BLOCK_STORED ? inBuf_size : 1) * sizeof(INBUF_T);
+        memcpy(payload, inBuf, text_size);
+        STATS_LAP(&scratch->stats, ST_CODE, timer);
+        STATS_ADD(&scratch->stats, blocks, 1);
+        STATS_ADD(&scratch->stats, symbols, inBuf_size);
+        STATS_ADD(&scratch->stats, payloadBits, (1 + text_size) * CHAR_BIT);
+        return 1 + text_size;
+    }
+    const htdata_t *ctxTables[CTX_LIM];
+    uint8_t maxLen = 0;
+    for (size_t ctx = 0; ctx < CTX_LIM; ctx++) {
+        ctxTables[ctx] = scratch->codeTable[scratch->ctxMap[ctx]];
+    }
+    for (uint8_t table = 0; table < scratch->tableCount; table++) {
+        for (size_t i = 0; i < INBUF_T_LIM; i++) {
+            maxLen = scratch->codeTable[table][i].len > maxLen ? scratch->codeTable[table][i].len : maxLen;
+        }
+    }
+
+    uint32_t jumpTable[HUFF_MAX_STREAMS];
+    uint8_t *streamStart = payload + jumpTableSize(opts->streams);
+    bitwriter_t bw;
+    bw_init(&bw, streamStart);
+    bw_write(&bw, scratch->repeat, 1);
+    if (!scratch->repeat) {
+        writeCodeTables(&bw, scratch, opts->mode);
+    }
+
+    // encoding
+    FILESIZE_T segment = (inBuf_size + opts->streams - 1) / opts->streams;
+    for (uint8_t stream = 0; stream < opts->streams; stream++) {
+        FILESIZE_T first = stream * segment < inBuf_size ? stream * segment : inBuf_size;
+        FILESIZE_T last = first + segment < inBuf_size ? first + segment : inBuf_size;
+        if (IS_CTX1(opts->mode)) {
+            encodeStreamBatched(&bw, inBuf + first, last - first, ctxTables, maxLen, true);
+        } else {
+            encodeStreamBatched(&bw, inBuf + first, last - first, ctxTables, maxLen, false);
+        }
+
+        // every bitstream starts with the new byte
+        uint8_t *streamEnd = bw_finish(&bw);
+        jumpTable[stream] = streamEnd - streamStart;
+        streamStart = streamEnd;
+    }
+    memcpy(payload, jumpTable, jumpTableSize(opts->streams));
+
+    size_t payload_size = 1 + (streamStart - payload);
+    STATS_LAP(&scratch->stats, ST_CODE, timer);
+    STATS_ADD(&scratch->stats, blocks, 1);
+    STATS_ADD(&scratch->stats, symbols, inBuf_size);
+    STATS_ADD(&scratch->stats, payloadBits, payload_size * CHAR_BIT);
+    STATS_MAX(&scratch->stats, maxCodeLen, maxLen);
+    return payload_size;
+}
+
+/**
+  @brief Calculates size of one bitstream by looking up code lengths of its symbols
+
+  @param[in] inBuf INBUF_T * Pointer to the symbols
+  @param[in] inBuf_size FILESIZE_T Number of symbols
+  @param[in] ctxTables htdata_t ** Code table of every previous symbol
+  @param[in] ctx bool Code table is chosen by the previous symbol, otherwise the first one is used
+  @return Size of the encoded symbols in bits
+*/
+static FILESIZE_T streamBits(const INBUF_T *inBuf, FILESIZE_T inBuf_size, const htdata_t * const *ctxTables, bool ctx) {
+    FILESIZE_T bits = 0;
+    INBUF_T prev = 0;
+    for (FILESIZE_T i = 0; i < inBuf_size; i++) {
+        bits += (ctx ? ctxTables[prev] : ctxTables[0])[inBuf[i]].len;
+        prev = inBuf[i];
+    }
+    return bits;
+}
+
+size_t blockPayloadSize(const INBUF_T *inBuf, uint32_t inBuf_size, const huffopts_t *opts, const blockscratch_t *scratch) {
+    if (scratch->type != BLOCK_CODED) {
+        return 1 + (scratch->type == BLOCK_STORED ? inBuf_size : 1) * sizeof(INBUF_T);
+    }
+    bool ctx1 = IS_CTX1(opts->mode);
+    // the first bitstream starts with the repeat flag and the new tables
+    FILESIZE_T headerBits = 1 + (scratch->repeat ? 0 : scratch->tableBits);
+    size_t payload_size = 1 + jumpTableSize(opts->streams);
+    if (opts->streams == 1) {
+        const FILESIZE_T *freqTable = ctx1 ? scratch->ctxFreqTable[0] : scratch->freqTable;
+        FILESIZE_T bits = headerBits;
+        for (size_t ctx = 0; ctx < (ctx1 ? CTX_LIM : 1); ctx++) {
+            const htdata_t *codeTable = scratch->codeTable[scratch->ctxMap[ctx]];
+            for (size_t i = 0; i < INBUF_T_LIM; i++) {
+                bits += freqTable[ctx * INBUF_T_LIM + i] * codeTable[i].len;
+            }
+        }
+        return payload_size + (bits + CHAR_BIT - 1) / CHAR_BIT;
+    }
+    const htdata_t *ctxTables[CTX_LIM];
+    for (size_t ctx = 0; ctx < CTX_LIM; ctx++) {
+        ctxTables[ctx] = scratch->codeTable[scratch->ctxMap[ctx]];
+    }
+    FILESIZE_T segment = (inBuf_size + opts->streams - 1) / opts->streams;
+    for (uint8_t stream = 0; stream < opts->streams; stream++) {
+        FILESIZE_T first = stream * segment < inBuf_size ? stream * segment : inBuf_size;
+        FILESIZE_T last = first + segment < inBuf_size ? first + segment : inBuf_size;
+        FILESIZE_T bits = (stream ? 0 : headerBits) + streamBits(inBuf + first, last - first, ctxTables, ctx1);
+        payload_size += (bits + CHAR_BIT - 1) / CHAR_BIT;
+    }
+    return payload_size;
+}
+
+void estimateBlock(const INBUF_T *inBuf, uint32_t inBuf_size, const huffopts_t *opts, const blockscratch_t *scratch,
+                   huffestimate_t *estimate) {
+    estimate->rawSize += inBuf_size * sizeof(INBUF_T);
+    estimate->encodedSize += sizeof(blockheader_t) + blockPayloadSize(inBuf, inBuf_size, opts, scratch);
+    estimate->shannonBound += scratch->entropy / CHAR_BIT;
+    estimate->blocks++;
+    estimate->storedBlocks += scratch->type != BLOCK_CODED;
+    estimate->repeatedTables += scratch->type == BLOCK_CODED && scratch->repeat;
+}
+
+/**
+  @brief Block symbol frequencies counting job
+
+  @param[in] arg blockjob_t * Block to count symbols of
+*/
+static void countBlockJob(void *arg) {
+    blockjob_t *job = (blockjob_t*)arg;
+    STATS_START(timer);
+    countBlockSymbols(job->text, job->block.rawSize, job->opts, job->scratch);
+    STATS_LAP(&job->scratch->stats, ST_HIST, timer);
+}
+
+/**
+  @brief Block encoding job
+
+  @param[in] arg blockjob_t * Block to encode
+*/
+static void encodeBlockJob(void *arg) {
+    blockjob_t *job = (blockjob_t*)arg;
+    job->block.payloadSize = encodeBlock(job->text, job->block.rawSize, job->payloadBuf, job->opts, job->scratch);
+    job->block.checksum = blockChecksum(job->text, job->block.rawSize);
+}
+
+void initFileHeader(fileheader_t *header, const huffopts_t *opts) {
+    *header = (fileheader_t){HUFF_MAGIC, HUFF_FORMAT_VERSION, HUFF_FLAG_INDEX | HUFF_SYMBOL_FLAG, opts->streams, opts->mode, opts->blockSize, 0, 0};
+}
+
+huff_status_t checkFileHeader(const fileheader_t *header) {
+    if (memcmp(header->magic, HUFF_MAGIC, sizeof(header->magic)) || header->version != HUFF_FORMAT_VERSION
+        || header->blockSize < HUFF_MIN_BLOCK_SIZE || header->blockSize > HUFF_MAX_BLOCK_SIZE
+        || !header->streams || header->streams > HUFF_MAX_STREAMS || header->mode > MAX_MODE
+        || (header->flags & HUFF_FLAG_SYMBOL16) != HUFF_SYMBOL_FLAG) {
+        return HUFF_ERR_FORMAT;
+    }
+    return HUFF_OK;
+}
+
+void getFileOpts(huffopts_t *opts, const fileheader_t *header) {
+    opts->blockSize = header->blockSize;
+    opts->streams = header->streams;
+    opts->mode = header->mode;
+    opts->symbolBits = header->flags & HUFF_FLAG_SYMBOL16 ? 16 : 8;
+}
+
+huff_status_t checkFileDict(const fileheader_t *header, const huffdict_t *dict) {
+    if ((header->flags & HUFF_FLAG_DICT) && (!dict || dict->id != header->dictId || dict->mode != header->mode)) {
+        return HUFF_ERR_DICT;
+    }
+    return HUFF_OK;
+}
+
+void initRefTable(reftable_t *ref, const huffdict_t *dict) {
+    if (!dict) {
+        ref->id = 0;
+    } else if (ref->id != DICT_TABLE_ID) {
+        uint32_t lastId = ref->lastId;
+        *ref = dict->table;
+        ref->lastId = lastId > DICT_TABLE_ID ? lastId : DICT_TABLE_ID;
+    }
+}
+
+huff_status_t addIndexEntry(blockindex_t *index, uint64_t offset, uint32_t rawSize, bool repeat) {
+    if (index->count == index->capacity) {
+        if (index->capacity >= INDEX_MAX_BLOCKS) {
+            return HUFF_ERR_PARAM;
+        }
+        uint32_t capacity = !index->capacity ? 64 : index->capacity < INDEX_MAX_BLOCKS / 2 ? index->capacity * 2 : INDEX_MAX_BLOCKS;
+        indexentry_t *entries = (indexentry_t*)realloc(index->entries, capacity * sizeof(indexentry_t));
+        if (!entries) {
+            return HUFF_ERR_MEMORY;
+        }
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+    indexentry_t *entry = &index->entries[index->count];
+    entry->offset = offset;
+    entry->rawOffset = index->count ? entry[-1].rawOffset + entry[-1].rawSize : 0;
+    entry->rawSize = rawSize;
+    if (!repeat) {
+        index->tableBlock = index->count;
+    }
+    entry->tableBlock = index->tableBlock;
+    index->count++;
+    return HUFF_OK;
+}
+
+size_t indexPayloadSize(uint32_t blocks) {
+    return blocks * sizeof(indexentry_t) + sizeof(indextrailer_t);
+}
+
+void writeIndex(const blockindex_t *index, uint64_t indexOffset, uint8_t *out) {
+    indextrailer_t trailer = {indexOffset, index->count, HUFF_INDEX_MAGIC};
+    if (index->count) {
+        memcpy(out, index->entries, index->count * sizeof(indexentry_t));
+    }
+    memcpy(out + index->count * sizeof(indexentry_t), &trailer, sizeof(trailer));
+}
+
+/**
+  @brief Allocates batches of the coding pipeline
+
+  Only a few blocks per thread are kept in RAM for every batch.
+  @param[out] p pipeline_t * Pipeline with the input, options and block size set
+  @param[in] threads size_t Number of coding threads
+  @param[in] textBufs bool Batches need text buffers
+*/
+static void initPipeline(pipeline_t *p, size_t threads, bool textBufs) {
+    p->jobCount = threads * BLOCKS_PER_THREAD;
+    p->payloadBound = blockPayloadBound(p->blockSize, p->opts);
+    for (size_t batch = 0; batch < PIPELINE_BATCHES; batch++) {
+        blockjob_t *jobs = (blockjob_t*)s_calloc(p->jobCount, sizeof(blockjob_t));
+        for (size_t i = 0; i < p->jobCount; i++) {
+            if (textBufs) {
+                jobs[i].textBuf = (INBUF_T*)s_malloc(p->blockSize * sizeof(INBUF_T));
+            }
+            // bit reader peeks one word past the payload
+            jobs[i].payloadBuf = (uint8_t*)s_malloc(p->payloadBound + sizeof(OUTBUF_T));
+            jobs[i].scratch = (blockscratch_t*)s_calloc(1, sizeof(blockscratch_t));
+            jobs[i].opts = p->opts;
+        }
+        p->batches[batch].jobs = jobs;
+    }
+    p->ref = (reftable_t*)s_calloc(1, sizeof(reftable_t));
+}
+
+/**
+  @brief Frees batches of the coding pipeline
+
+  @param[in,out] p pipeline_t * Pipeline
+*/
+static void freePipeline(pipeline_t *p) {
+    for (size_t batch = 0; batch < PIPELINE_BATCHES; batch++) {
+        for (size_t i = 0; i < p->jobCount; i++) {
+            free(p->batches[batch].jobs[i].textBuf);
+            free(p->batches[batch].jobs[i].payloadBuf);
+            free(p->batches[batch].jobs[i].scratch);
+        }
+        free(p->batches[batch].jobs);
+    }
+    free(p->ref);
+    free(p->index.entries);
+}
+
+/**
+  @brief Runs batches through the reader, coding and writer stages
+
+  Batch is read ahead while the previous one is coded and the one before it is written,
+  so the wall time tends to the time of the slowest stage.
+  Stops at the end of the input or at the first error of any stage.
+  @param[in,out] p pipeline_t * Pipeline
+  @param[in] pool thpool_t * Pool coding the blocks
+  @param[in] readJob thjob_t Reader stage job, fills p->readBatch
+  @param[in] code batchcoder_t Coding stage, runs on the calling thread
+  @param[in] writeJob thjob_t Writer stage job, writes p->writeBatch
+  @return HUFF_OK or error code
+*/
+static huff_status_t runPipeline(pipeline_t *p, thpool_t *pool, thjob_t readJob, batchcoder_t code, thjob_t writeJob) {
+    thstage_t *reader = tp_stageInit();
+    thstage_t *writer = tp_stageInit();
+    huff_status_t status = HUFF_OK;
+    p->writeStatus = HUFF_OK;
+    p->readBatch = &p->batches[0];
+    tp_stageStart(reader, readJob, p);
+    for (size_t i = 0; status == HUFF_OK; i++) {
+        blockbatch_t *batch = &p->batches[i % PIPELINE_BATCHES];
+        tp_stageWait(reader);
+        status = batch->status;
+        // the next batch takes buffers of the batch whose writing is already finished
+        if (status == HUFF_OK && !batch->eof) {
+            p->readBatch = &p->batches[(i + 1) % PIPELINE_BATCHES];
+            tp_stageStart(reader, readJob, p);
+        }
+        if (status == HUFF_OK) {
+            code(p, batch, pool);
+        }
+        tp_stageWait(writer);
+        if (status == HUFF_OK && (status = p->writeStatus) == HUFF_OK) {
+            p->writeBatch = batch;
+            tp_stageStart(writer, writeJob, p);
+        }
+        if (batch->eof) {
+            break;
+        }
+    }
+    tp_stageFree(&reader);
+    tp_stageFree(&writer);
+    STATS_MERGE(p->stats, &p->readStats);
+    STATS_MERGE(p->stats, &p->writeStats);
+    return status == HUFF_OK ? p->writeStatus : status;
+}
+
+/**
+  @brief Encoder reader stage job
+
+  @param[in] arg pipeline_t * Pipeline, gets the text of p->readBatch blocks
+*/
+static void readTextBatch(void *arg) {
+    pipeline_t *p = (pipeline_t*)arg;
+    blockbatch_t *batch = p->readBatch;
+    STATS_START(timer);
+    batch->count = 0;
+    batch->eof = false;
+    batch->status = HUFF_OK;
+    for (; batch->count < p->jobCount; batch->count++) {
+        blockjob_t *job = &batch->jobs[batch->count];
+        size_t rawSize = 0;
+        job->text = (const INBUF_T*)fin_read(&p->in, p->blockSize * sizeof(INBUF_T), (uint8_t*)job->textBuf, &rawSize);
+        job->block.rawSize = rawSize / sizeof(INBUF_T);
+        if (rawSize % sizeof(INBUF_T)) {
+            batch->status = HUFF_ERR_SYMBOL_SIZE;
+            break;
+        }
+        if (!job->block.rawSize) {
+            batch->eof = true;
+            break;
+        }
+        STATS_ADD(p->stats, bytesIn, rawSize);
+    }
+    // mapped text of the next batch is paged in while this one is coded
+    fin_prefetch(&p->in, p->jobCount * p->blockSize * sizeof(INBUF_T));
+    STATS_LAP(&p->readStats, ST_READ, timer);
+}
+
+/**
+  @brief Encoder coding stage
+
+  @param[in,out] p pipeline_t * Pipeline with the reference table
+  @param[in,out] batch blockbatch_t * Batch to encode
+  @param[in] pool thpool_t * Pool coding the blocks
+*/
+static void encodeBatch(pipeline_t *p, blockbatch_t *batch, thpool_t *pool) {
+    // tables depend on the previous blocks, so they are chosen in order between two parallel passes
+    tp_run(pool, countBlockJob, batch->jobs, sizeof(blockjob_t), batch->count);
+    for (size_t i = 0; i < batch->count; i++) {
+        selectCodeTable(p->ref, p->opts, batch->jobs[i].scratch);
+    }
+    tp_run(pool, encodeBlockJob, batch->jobs, sizeof(blockjob_t), batch->count);
+}
+
+/**
+  @brief Encoder writer stage job
+
+  @param[in] arg pipeline_t * Pipeline, writes the encoded p->writeBatch blocks and indexes them
+*/
+static void writeCodeBatch(void *arg) {
+    pipeline_t *p = (pipeline_t*)arg;
+    blockbatch_t *batch = p->writeBatch;
+    STATS_START(timer);
+    // blocks are written in the original order
+    for (size_t i = 0; i < batch->count && p->writeStatus == HUFF_OK; i++) {
+        blockjob_t *job = &batch->jobs[i];
+        p->writeStatus = addIndexEntry(&p->index, p->filePos, job->block.rawSize, job->scratch->repeat);
+        if (p->writeStatus == HUFF_OK && (fwrite(&job->block, sizeof(blockheader_t), 1, p->output) != 1
+            || fwrite(job->payloadBuf, 1, job->block.payloadSize, p->output) != job->block.payloadSize)) {
+            p->writeStatus = HUFF_ERR_IO;
+        }
+        p->filePos += sizeof(blockheader_t) + job->block.payloadSize;
+        STATS_ADD(p->stats, bytesOut, sizeof(blockheader_t) + job->block.payloadSize);
+        STATS_MERGE(&p->writeStats, &job->scratch->stats);
+    }
+    STATS_LAP(&p->writeStats, ST_WRITE, timer);
+}
+
+huff_status_t encodeFile(FILE * const input, FILE * const output, const huffopts_t * const opts, const huffdict_t *dict, huffstats_t *stats) {
+    // printInfo(ENCODING_START);
+    if (HUFF_SYMBOL_BITS == 8 && opts->symbolBits == 16) {
+        return encodeWideFile(input, output, opts, stats);
+    }
+    STATS_START(total);
+
+    pipeline_t p = {0};
+    p.output = output;
+    p.opts = opts;
+    p.blockSize = opts->blockSize;
+    p.stats = stats;
+    fin_open(&p.in, input);
+
+    fileheader_t header;
+    initFileHeader(&header, opts);
+    if (fin_mapped(&p.in)) {
+        header.flags |= HUFF_FLAG_CONTENT_SIZE;
+        header.contentSize = fin_mapped(&p.in);
+    }
+    if (dict) {
+        header.flags |= HUFF_FLAG_DICT;
+        header.dictId = dict->id;
+    }
+    huff_status_t status = fwrite(&header, sizeof(header), 1, output) == 1 ? HUFF_OK : HUFF_ERR_IO;
+    STATS_ADD(stats, bytesOut, sizeof(header));
+    p.filePos = sizeof(header);
+
+    // mapped input isn't copied at all
+    initPipeline(&p, opts->threads, !p.in.map);
+    initRefTable(p.ref, header.flags & HUFF_FLAG_DICT ? dict : NULL);
+    thpool_t *pool = tp_init(opts->threads);
+    if (status == HUFF_OK) {
+        status = runPipeline(&p, pool, readTextBatch, encodeBatch, writeCodeBatch);
+    }
+
+    // zero sized block marks the end of the stream and holds the block index
+    blockheader_t end = {0, indexPayloadSize(p.index.count), 0};
+    uint8_t *indexBuf = (uint8_t*)s_malloc(end.payloadSize);
+    writeIndex(&p.index, p.filePos, indexBuf);
+    if (status == HUFF_OK && (fwrite(&end, sizeof(end), 1, output) != 1
+        || fwrite(indexBuf, 1, end.payloadSize, output) != end.payloadSize || ferror(input))) {
+        status = HUFF_ERR_IO;
+    }
+    STATS_ADD(stats, bytesOut, sizeof(end) + end.payloadSize);
+    free(indexBuf);
+
+    freePipeline(&p);
+    tp_free(&pool);
+    fin_close(&p.in);
+    STATS_LAP(stats, ST_TOTAL, total);
+    return status;
+}
+
+/**
+  @brief Block estimating job
+
+  @param[in] arg blockjob_t * Block to estimate
+*/
+static void estimateBlockJob(void *arg) {
+    blockjob_t *job = (blockjob_t*)arg;
+    memset(&job->estimate, 0, sizeof(job->estimate));
+    estimateBlock(job->text, job->block.rawSize, job->opts, job->scratch, &job->estimate);
+}
+
+/**
+  @brief Estimator coding stage
+
+  @param[in,out] p pipeline_t * Pipeline with the reference table
+  @param[in,out] batch blockbatch_t * Batch to estimate
+  @param[in] pool thpool_t * Pool estimating the blocks
+*/
+static void estimateBatch(pipeline_t *p, blockbatch_t *batch, thpool_t *pool) {
+    // tables are chosen exactly as the encoder does, only the encoding pass is replaced
+    tp_run(pool, countBlockJob, batch->jobs, sizeof(blockjob_t), batch->count);
+    for (size_t i = 0; i < batch->count; i++) {
+        selectCodeTable(p->ref, p->opts, batch->jobs[i].scratch);
+    }
+    tp_run(pool, estimateBlockJob, batch->jobs, sizeof(blockjob_t), batch->count);
+}
+
+/**
+  @brief Estimator writer stage job
+
+  @param[in] arg pipeline_t * Pipeline, adds estimates of p->writeBatch blocks to the file one
+*/
+static void writeEstimateBatch(void *arg) {
+    pipeline_t *p = (pipeline_t*)arg;
+    blockbatch_t *batch = p->writeBatch;
+    for (size_t i = 0; i < batch->count; i++) {
+        const huffestimate_t *block = &batch->jobs[i].estimate;
+        p->estimate->rawSize += block->rawSize;
+        p->estimate->encodedSize += block->encodedSize;
+        p->estimate->shannonBound += block->shannonBound;
+        p->estimate->blocks += block->blocks;
+        p->estimate->storedBlocks += block->storedBlocks;
+        p->estimate->repeatedTables += block->repeatedTables;
+        if (p->estimateWrite) {
+            p->estimateWrite(p->estimateArg, block);
+        }
+    }
+}
+
+huff_status_t estimateFile(FILE * const input, const huffopts_t * const opts, const huffdict_t *dict,
+                           estimatewriter_t write, void *arg, huffestimate_t *estimate) {
+    if (HUFF_SYMBOL_BITS == 8 && opts->symbolBits == 16) {
+        return estimateWideFile(input, opts, write, arg, estimate);
+    }
+    pipeline_t p = {0};
+    p.opts = opts;
+    p.blockSize = opts->blockSize;
+    p.estimate = estimate;
+    p.estimateWrite = write;
+    p.estimateArg = arg;
+    memset(estimate, 0, sizeof(*estimate));
+    estimate->encodedSize = sizeof(fileheader_t);
+    fin_open(&p.in, input);
+
+    initPipeline(&p, opts->threads, !p.in.map);
+    initRefTable(p.ref, dict);
+    thpool_t *pool = tp_init(opts->threads);
+    huff_status_t status = runPipeline(&p, pool, readTextBatch, estimateBatch, writeEstimateBatch);
+    if (status == HUFF_OK && ferror(input)) {
+        status = HUFF_ERR_IO;
+    }
+    // end block holds the index of all the blocks
+    estimate->encodedSize += sizeof(blockheader_t) + indexPayloadSize(estimate->blocks);
+
+    freePipeline(&p);
+    tp_free(&pool);
+    fin_close(&p.in);
+    return status;
+}
+
+/**
+  @brief Decodes one symbol
+
+  @param[in] br bitreader_t * Reader positioned at the symbol code
+  @param[in] dtable dtable_t * Pointer to the decoding table
+  @param[out] symb INBUF_T * Decoded symbol
+  @return false if no code matches
+*/
+static inline bool decodeSymbol(bitreader_t *br, const dtable_t *dtable, INBUF_T *symb) {
+    uint64_t bits = br_peek(br);
+    dtentry_t entry = dtable->fast[bits >> (OUTBUF_T_SIZE - DECODE_TABLE_BITS)];
+    if (!entry.len) {
+        entry.len = decodeLongCode(dtable, bits, &entry.symb);
+        if (!entry.len) {
+            return false;
+        }
+    }
+    *symb = entry.symb;
+    br_skip(br, entry.len);
+    return true;
+}
+
+/**
+  @brief Decodes symbols of one bitstream
+
+  @param[in] br bitreader_t * Reader positioned at the first symbol code
+  @param[in] inBuf_bits FILESIZE_T Position of the bitstream end
+  @param[out] outBuf INBUF_T * Buffer for the decoded text
+  @param[in] outBuf_size FILESIZE_T Number of symbols to decode
+  @param[in] ctxTables dtable_t ** Decoding table of every previous symbol
+  @param[in] maxLen uint8_t Maximal code length
+  @param[in] prev INBUF_T Symbol preceding the first decoded one
+  @param[in] ctx bool Decoding table is chosen by the previous symbol, otherwise the first one is used
+  @return true if all the symbols are decoded inside the bitstream
+*/
+static inline __attribute__((always_inline)) bool decodeStream(bitreader_t *br, FILESIZE_T inBuf_bits, INBUF_T *outBuf, FILESIZE_T outBuf_size,
+                                                                const dtable_t * const *ctxTables, uint8_t maxLen, INBUF_T prev, bool ctx) {
+    const dtable_t *dtable = ctxTables[0];
+    FILESIZE_T outBuf_index = 0;
+    while (outBuf_index < outBuf_size) {
+        // symbols which are guaranteed to stay inside the buffer are decoded without bounds checks
+        FILESIZE_T safeCount = br->pos < inBuf_bits ? (inBuf_bits - br->pos) / maxLen : 0;
+        if (safeCount > outBuf_size - outBuf_index) {
+            safeCount = outBuf_size - outBuf_index;
+        } else if (!safeCount) {
+            safeCount = 1;
+        }
+        for (FILESIZE_T last = outBuf_index + safeCount; outBuf_index < last; outBuf_index++) {
+            if (!decodeSymbol(br, ctx ? ctxTables[prev] : dtable, &prev)) {
+                return false;
+            }
+            outBuf[outBuf_index] = prev;
+        }
+        if (br->pos > inBuf_bits) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+  @brief Decodes symbols of several bitstreams in turn
+
+  Decoding of independent bitstreams overlaps in CPU pipeline.
+  Interleaved decoding continues while all the bitstreams can be decoded without bounds checks,
+  the rest of every bitstream is decoded separately.
+  @param[in] br bitreader_t * Readers positioned at the first symbols codes
+  @param[in] inBuf_bits FILESIZE_T * Positions of the bitstreams ends
+  @param[out] outBuf INBUF_T * Buffer for the decoded text
+  @param[in] segment FILESIZE_T Number of symbols in every bitstream but the last one
+  @param[in] outBuf_size FILESIZE_T Size of the decoded text
+  @param[in] ctxTables dtable_t ** Decoding table of every previous symbol
+  @param[in] maxLen uint8_t Maximal code length
+  @param[in] streams uint8_t Number of bitstreams
+  @param[in] ctx bool Decoding table is chosen by the previous symbol, otherwise the first one is used
+  @return true if all the symbols are decoded inside their bitstreams
+*/
+static inline __attribute__((always_inline)) bool decodeStreams(bitreader_t *br, const FILESIZE_T *inBuf_bits, INBUF_T *outBuf,
+                                                                 FILESIZE_T segment, FILESIZE_T outBuf_size,
+                                                                 const dtable_t * const *ctxTables, uint8_t maxLen, uint8_t streams, bool ctx) {
+    const dtable_t *dtable = ctxTables[0];
+    // every bitstream starts with zero context
+    INBUF_T prev[HUFF_MAX_STREAMS] = {0};
+    FILESIZE_T lastSegment = outBuf_size > (streams - 1) * segment ? outBuf_size - (streams - 1) * segment : 0;
+    FILESIZE_T outBuf_index = 0;
+    while (outBuf_index < lastSegment) {
+        FILESIZE_T safeCount = lastSegment - outBuf_index;
+        for (uint8_t stream = 0; stream < streams; stream++) {
+            FILESIZE_T streamSafe = br[stream].pos < inBuf_bits[stream] ? (inBuf_bits[stream] - br[stream].pos) / maxLen : 0;
+            safeCount = streamSafe < safeCount ? streamSafe : safeCount;
+        }
+        if (!safeCount) {
+            break;
+        }
+        for (FILESIZE_T last = outBuf_index + safeCount; outBuf_index < last; outBuf_index++) {
+            for (uint8_t stream = 0; stream < streams; stream++) {
+                if (!decodeSymbol(&br[stream], ctx ? ctxTables[prev[stream]] : dtable, &prev[stream])) {
+                    return false;
+                }
+                outBuf[stream * segment + outBuf_index] = prev[stream];
+            }
+        }
+    }
+    for (uint8_t stream = 0; stream < streams; stream++) {
+        FILESIZE_T first = stream * segment < outBuf_size ? stream * segment : outBuf_size;
+        FILESIZE_T last = first + segment < outBuf_size ? first + segment : outBuf_size;
+        if (first + outBuf_index < last
+            && !decodeStream(&br[stream], inBuf_bits[stream], outBuf + first + outBuf_index, last - first - outBuf_index,
+                             ctxTables, maxLen, prev[stream], ctx)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+  @brief Decodes symbols of all the bitstreams
+
+  Common stream numbers get specialized unrolled loops.
+  @param[in] br bitreader_t * Readers positioned at the first symbols codes
+  @param[in] inBuf_bits FILESIZE_T * Positions of the bitstreams ends
+  @param[out] outBuf INBUF_T * Buffer for the decoded text
+  @param[in] outBuf_size FILESIZE_T Size of the decoded text
+  @param[in] ctxTables dtable_t ** Decoding table of every previous symbol
+  @param[in] maxLen uint8_t Maximal code length
+  @param[in] streams uint8_t Number of bitstreams
+  @param[in] ctx bool Decoding table is chosen by the previous symbol, otherwise the first one is used
+  @return true if all the symbols are decoded inside their bitstreams
+*/
+static inline __attribute__((always_inline)) bool decodeAllStreams(bitreader_t *br, const FILESIZE_T *inBuf_bits, INBUF_T *outBuf, FILESIZE_T outBuf_size,
+                                                                    const dtable_t * const *ctxTables, uint8_t maxLen, uint8_t streams, bool ctx) {
+    FILESIZE_T segment = (outBuf_size + streams - 1) / streams;
+    switch (streams) {
+        case 1:
+            return decodeStream(&br[0], inBuf_bits[0], outBuf, outBuf_size, ctxTables, maxLen, 0, ctx);
+        case 2:
+            return decodeStreams(br, inBuf_bits, outBuf, segment, outBuf_size, ctxTables, maxLen, 2, ctx);
+        case 4:
+            return decodeStreams(br, inBuf_bits, outBuf, segment, outBuf_size, ctxTables, maxLen, 4, ctx);
+        case 8:
+            return decodeStreams(br, inBuf_bits, outBuf, segment, outBuf_size, ctxTables, maxLen, 8, ctx);
+        default:
+            return decodeStreams(br, inBuf_bits, outBuf, segment, outBuf_size, ctxTables, maxLen, streams, ctx);
+    }
+}
+
+/**
+  @brief Sets up readers of the block bitstreams
+
+  @param[in] payload uint8_t * Pointer to the encoded block
+  @param[in] payload_size size_t Size of the encoded block
+  @param[in] streams uint8_t Number of bitstreams
+  @param[out] br bitreader_t * Readers positioned at the bitstreams starts
+  @param[out] inBuf_bits FILESIZE_T * Positions of the bitstreams ends
+  @return false if the bitstreams don't fit into the block
+*/
+static bool initStreams(const uint8_t *payload, size_t payload_size, uint8_t streams, bitreader_t *br, FILESIZE_T *inBuf_bits) {
+    if (payload_size < jumpTableSize(streams)) {
+        return false;
+    }
+    uint32_t jumpTable[HUFF_MAX_STREAMS];
+    memcpy(jumpTable, payload, jumpTableSize(streams));
+    const uint8_t *inBuf = payload + jumpTableSize(streams);
+    FILESIZE_T inBuf_size = payload_size - jumpTableSize(streams);
+
+    FILESIZE_T streamStart = 0;
+    for (uint8_t stream = 0; stream < streams; stream++) {
+        FILESIZE_T streamSize = stream + 1 < streams ? jumpTable[stream] : inBuf_size - streamStart;
+        if (streamStart + streamSize > inBuf_size) {
+            return false;
+        }
+        br_init(&br[stream], inBuf + streamStart);
+        inBuf_bits[stream] = streamSize * CHAR_BIT;
+        streamStart += streamSize;
+    }
+    return true;
+}
+
+/**
+  @brief Reads code tables written by writeCodeTables
+
+  @param[in] br bitreader_t * Reader positioned at the tables
+  @param[in] inBuf_bits FILESIZE_T Position of the bitstream end
+  @param[out] ref reftable_t * Tables to fill
+  @param[in] mode uint8_t Coding mode
+  @return true if the tables are valid
+*/
+static bool readCodeTables(bitreader_t *br, FILESIZE_T inBuf_bits, reftable_t *ref, uint8_t mode) {
+    ref->tableCount = 1;
+    memset(ref->ctxMap, 0, sizeof(ref->ctxMap));
+    if (IS_CTX1(mode)) {
+        ref->tableCount = br_read(br, CTX_TABLES_BITS) + 1;
+        uint8_t mapBits = ctxMapBits(ref->tableCount);
+        for (size_t ctx = 0; ctx < CTX_LIM && mapBits; ctx++) {
+            ref->ctxMap[ctx] = br_read(br, mapBits);
+            if (ref->ctxMap[ctx] >= ref->tableCount || br->pos > inBuf_bits) {
+                return false;
+            }
+        }
+    }
+    for (uint8_t table = 0; table < ref->tableCount; table++) {
+        if (!readCodeLengths(br, inBuf_bits, ref->codeTable[table])) {
+            return false;
+        }
+        assignCanonicalCodes(ref->codeTable[table]);
+    }
+    return true;
+}
+
+bool readBlockTable(const uint8_t *payload, size_t payload_size, const huffopts_t *opts, reftable_t *ref, blockscratch_t *scratch) {
+    if (!payload_size) {
+        return false;
+    }
+    scratch->type = payload[0];
+    if (scratch->type != BLOCK_CODED) {
+        scratch->repeat = true;
+        STATS_ADD(&scratch->stats, storedBlocks, 1);
+        return scratch->type == BLOCK_STORED || scratch->type == BLOCK_RUN;
+    }
+    bitreader_t br[HUFF_MAX_STREAMS];
+    FILESIZE_T inBuf_bits[HUFF_MAX_STREAMS];
+    if (!initStreams(payload + 1, payload_size - 1, opts->streams, br, inBuf_bits) || !inBuf_bits[0]) {
+        return false;
+    }
+    STATS_START(timer);
+    scratch->repeat = br_read(&br[0], 1);
+    if (!scratch->repeat) {
+        ref->id = ++ref->lastId;
+        if (!readCodeTables(&br[0], inBuf_bits[0], ref, opts->mode)) {
+            return false;
+        }
+        ref->tableBits = br[0].pos - 1;
+    } else if (!ref->id) {
+        return false;
+    }
+    copyRefTable(ref, scratch);
+    STATS_LAP(&scratch->stats, ST_TABLE, timer);
+    STATS_ADD(&scratch->stats, repeatedTables, scratch->repeat);
+    return true;
+}
+
+void preloadDecodeTables(const reftable_t *ref, blockscratch_t *scratch) {
+    copyRefTable(ref, scratch);
+    if (scratch->decodeTableId != scratch->tableId) {
+        for (uint8_t table = 0; table < scratch->tableCount; table++) {
+            buildDecodeTable(&scratch->dtable[table], scratch->codeTable[table]);
+        }
+        scratch->decodeTableId = scratch->tableId;
+    }
+}
+
+/**
+  @brief Decodes stored block or run
+
+  @param[in] payload uint8_t * Pointer to the encoded block
+  @param[in] payload_size size_t Size of the encoded block
+  @param[out] outBuf INBUF_T * Buffer for the decoded text
+  @param[in] outBuf_size uint32_t Size of the decoded text
+  @param[in,out] scratch blockscratch_t * Scratch memory with the block type
+  @return true if the block has the size of its text
+*/
+static bool decodeStoredBlock(const uint8_t *payload, size_t payload_size, INBUF_T *outBuf, uint32_t outBuf_size, blockscratch_t *scratch) {
+    STATS_START(timer);
+    if (scratch->type == BLOCK_STORED) {
+        if (payload_size != 1 + (size_t)outBuf_size * sizeof(INBUF_T)) {
+            return false;
+        }
+        memcpy(outBuf, payload + 1, outBuf_size * sizeof(INBUF_T));
+    } else {
+        if (payload_size != 1 + sizeof(INBUF_T)) {
+            return false;
+        }
+        INBUF_T symb;
+        memcpy(&symb, payload + 1, sizeof(symb));
+        for (uint32_t i = 0; i < outBuf_size; i++) {
+            outBuf[i] = symb;
+        }
+    }
+    STATS_LAP(&scratch->stats, ST_CODE, timer);
+    STATS_ADD(&scratch->stats, blocks, 1);
+    STATS_ADD(&scratch->stats, symbols, outBuf_size);
+    STATS_ADD(&scratch->stats, payloadBits, payload_size * CHAR_BIT);
+    return true;
+}
+
+bool decodeBlock(const uint8_t *payload, size_t payload_size, INBUF_T *outBuf, uint32_t outBuf_size, blockscratch_t *scratch, const huffopts_t *opts) {
+    if (scratch->type != BLOCK_CODED) {
+        return decodeStoredBlock(payload, payload_size, outBuf, outBuf_size, scratch);
+    }
+    bitreader_t br[HUFF_MAX_STREAMS];
+    FILESIZE_T inBuf_bits[HUFF_MAX_STREAMS];
+    if (!payload_size || !initStreams(payload + 1, payload_size - 1, opts->streams, br, inBuf_bits)) {
+        return false;
+    }
+    br_skip(&br[0], scratch->repeat ? 1 : 1 + scratch->tableBits);
+    if (br[0].pos > inBuf_bits[0]) {
+        return false;
+    }
+
+    STATS_START(timer);
+    if (scratch->decodeTableId != scratch->tableId) {
+        for (uint8_t table = 0; table < scratch->tableCount; table++) {
+            buildDecodeTable(&scratch->dtable[table], scratch->codeTable[table]);
+        }
+        scratch->decodeTableId = scratch->tableId;
+    }
+    const dtable_t *ctxTables[CTX_LIM];
+    for (size_t ctx = 0; ctx < CTX_LIM; ctx++) {
+        ctxTables[ctx] = &scratch->dtable[scratch->ctxMap[ctx]];
+    }
+    uint8_t maxLen = 0;
+    for (uint8_t table = 0; table < scratch->tableCount; table++) {
+        maxLen = scratch->dtable[table].maxLen > maxLen ? scratch->dtable[table].maxLen : maxLen;
+    }
+    STATS_LAP(&scratch->stats, ST_TABLE, timer);
+
+    bool ok;
+    if (IS_CTX1(opts->mode)) {
+        ok = decodeAllStreams(br, inBuf_bits, outBuf, outBuf_size, ctxTables, maxLen, opts->streams, true);
+    } else {
+        ok = decodeAllStreams(br, inBuf_bits, outBuf, outBuf_size, ctxTables, maxLen, opts->streams, false);
+    }
+    STATS_LAP(&scratch->stats, ST_CODE, timer);
+    STATS_ADD(&scratch->stats, blocks, 1);
+    STATS_ADD(&scratch->stats, symbols, outBuf_size);
+    STATS_ADD(&scratch->stats, payloadBits, payload_size * CHAR_BIT);
+    STATS_MAX(&scratch->stats, maxCodeLen, maxLen);
+    return ok;
+}
+
+uint32_t blockChecksum(const INBUF_T *text, uint32_t size) {
+    return cs_crc32c((const uint8_t*)text, size * sizeof(INBUF_T));
+}
+
+/**
+  @brief Block decoding job
+
+  @param[in] arg blockjob_t * Block to decode
+*/
+static void decodeBlockJob(void *arg) {
+    blockjob_t *job = (blockjob_t*)arg;
+    if (!decodeBlock(job->payload, job->block.payloadSize, job->decoded, job->block.rawSize, job->scratch, job->opts)) {
+        job->status = HUFF_ERR_CORRUPTED;
+    } else if (blockChecksum(job->decoded, job->block.rawSize) != job->block.checksum) {
+        job->status = HUFF_ERR_CHECKSUM;
+    } else {
+        job->status = HUFF_OK;
+    }
+}
+
+/**
+  @brief Decoder reader stage job
+
+  Reads tables of the blocks in order, since they depend on the previous blocks.
+  @param[in] arg pipeline_t * Pipeline with the reference table, gets the p->readBatch blocks
+*/
+static void readCodeBatch(void *arg) {
+    pipeline_t *p = (pipeline_t*)arg;
+    blockbatch_t *batch = p->readBatch;
+    STATS_START(timer);
+    batch->count = 0;
+    batch->eof = false;
+    batch->status = HUFF_OK;
+    for (; batch->count < p->jobCount; batch->count++) {
+        blockjob_t *job = &batch->jobs[batch->count];
+        size_t got = 0;
+        const uint8_t *data = fin_read(&p->in, sizeof(blockheader_t), (uint8_t*)&job->block, &got);
+        memmove(&job->block, data, got);
+        if (got != sizeof(blockheader_t)) {
+            batch->status = HUFF_ERR_CORRUPTED;
+            break;
+        }
+        if (!job->block.rawSize) {
+            batch->eof = true;
+            break;
+        }
+        if (job->block.rawSize > p->blockSize || job->block.payloadSize > p->payloadBound) {
+            batch->status = HUFF_ERR_CORRUPTED;
+            break;
+        }
+        job->payload = fin_read(&p->in, job->block.payloadSize, job->payloadBuf, &got);
+        if (got != job->block.payloadSize) {
+            batch->status = HUFF_ERR_CORRUPTED;
+            break;
+        }
+        // bit reader peeks one word past the end, it should stay inside the mapping
+        if (job->payload != job->payloadBuf && fin_mapped(&p->in) < sizeof(OUTBUF_T)) {
+            memcpy(job->payloadBuf, job->payload, got);
+            job->payload = job->payloadBuf;
+        }
+        if (job->payload == job->payloadBuf) {
+            memset(job->payloadBuf + got, 0, sizeof(OUTBUF_T));
+        }
+        if (!readBlockTable(job->payload, got, p->opts, p->ref, job->scratch)) {
+            batch->status = HUFF_ERR_CORRUPTED;
+            break;
+        }
+        job->decoded = (INBUF_T*)fout_reserve(&p->out, job->block.rawSize * sizeof(INBUF_T), (uint8_t*)job->textBuf);
+        if (!job->decoded) {
+            batch->status = HUFF_ERR_CORRUPTED;
+            break;
+        }
+        STATS_ADD(p->stats, bytesIn, sizeof(blockheader_t) + got);
+    }
+    // mapped blocks of the next batch are paged in while this one is decoded
+    fin_prefetch(&p->in, p->jobCount * (sizeof(blockheader_t) + p->payloadBound));
+    STATS_LAP(&p->readStats, ST_READ, timer);
+}
+
+/**
+  @brief Decoder coding stage
+
+  @param[in,out] p pipeline_t * Pipeline
+  @param[in,out] batch blockbatch_t * Batch to decode
+  @param[in] pool thpool_t * Pool coding the blocks
+*/
+static void decodeBatch(pipeline_t *p, blockbatch_t *batch, thpool_t *pool) {
+    (void)p;
+    tp_run(pool, decodeBlockJob, batch->jobs, sizeof(blockjob_t), batch->count);
+}
+
+/**
+  @brief Decoder writer stage job
+
+  @param[in] arg pipeline_t * Pipeline, writes the decoded p->writeBatch blocks
+*/
+static void writeTextBatch(void *arg) {
+    pipeline_t *p = (pipeline_t*)arg;
+    blockbatch_t *batch = p->writeBatch;
+    STATS_START(timer);
+    // blocks are written in the original order
+    for (size_t i = 0; i < batch->count && p->writeStatus == HUFF_OK; i++) {
+        blockjob_t *job = &batch->jobs[i];
+        if (job->status != HUFF_OK) {
+            p->writeStatus = job->status;
+        } else if (!fout_write(&p->out, (const uint8_t*)job->decoded, job->block.rawSize * sizeof(INBUF_T))) {
+            p->writeStatus = HUFF_ERR_IO;
+        }
+        p->decodedSize += job->block.rawSize;
+        STATS_MERGE(&p->writeStats, &job->scratch->stats);
+    }
+    STATS_LAP(&p->writeStats, ST_WRITE, timer);
+}
+
+/**
+  @brief Checks content size of the file header against the block index
+
+  Output is sized by the header before any block is decoded, so a corrupted size could make a huge file.
+  Size is trusted only if the index entries follow each other without gaps, none of them is larger
+  than the file block size, and together they make the header size.
+  @param[in] in fin_t * Input positioned after the file header
+  @param[in] header fileheader_t * File header with HUFF_FLAG_CONTENT_SIZE set
+  @param[in] opts huffopts_t * Decoder options
+  @param[in] dict huffdict_t * Dictionary the file was encoded with, may be NULL
+  @return true if the index confirms the content size, false if it doesn't or the input isn't mapped
+*/
+static bool checkContentSize(const fin_t *in, const fileheader_t *header, const huffopts_t * const opts, const huffdict_t *dict) {
+    if (!in->map || in->pos < sizeof(fileheader_t)) {
+        return false;
+    }
+    indexedfile_t file;
+    if (openIndexedFile(&file, in->map + in->pos - sizeof(fileheader_t), fin_mapped(in) + sizeof(fileheader_t), opts, dict) != HUFF_OK
+        || memcmp(&file.header, header, sizeof(fileheader_t))) {
+        return false;
+    }
+    uint64_t rawOffset = 0;
+    for (uint32_t block = 0; block < file.blocks; block++) {
+        indexentry_t entry;
+        memcpy(&entry, file.entries + (size_t)block * sizeof(indexentry_t), sizeof(entry));
+        if (entry.rawOffset != rawOffset || !entry.rawSize || entry.rawSize > header->blockSize) {
+            return false;
+        }
+        rawOffset += entry.rawSize;
+    }
+    return rawOffset * sizeof(INBUF_T) == header->contentSize;
+}
+
+/**
+  @brief Decodes blocks following the file header
+
+  @param[in,out] in fin_t * Input positioned after the file header
+  @param[in] header fileheader_t * File header
+  @param[in] output FILE * File to write decoded text to, NULL to only verify the input
+  @param[in] opts huffopts_t * Decoder options
+  @param[in] dict huffdict_t * Dictionary the file was encoded with, may be NULL
+  @param[out] stats huffstats_t * Statistics to add to, may be NULL
+  @return HUFF_OK or error code
+*/
+static huff_status_t decodeBlocks(fin_t *in, const fileheader_t *header, FILE * const output, const huffopts_t * const opts,
+                                  const huffdict_t *dict, huffstats_t *stats) {
+    if (checkFileHeader(header) != HUFF_OK) {
+        return HUFF_ERR_FORMAT;
+    }
+    if (checkFileDict(header, dict) != HUFF_OK) {
+        return HUFF_ERR_DICT;
+    }
+    pipeline_t p = {0};
+    p.stats = stats;
+    p.in = *in;
+    huffopts_t blockOpts = *opts;
+    getFileOpts(&blockOpts, header);
+    p.opts = &blockOpts;
+    p.blockSize = header->blockSize;
+
+    // output of known size is mapped and decoded in place, other output is written as it is decoded
+    bool knownSize = (header->flags & HUFF_FLAG_CONTENT_SIZE) && checkContentSize(in, header, opts, dict);
+    fout_open(&p.out, output, knownSize ? header->contentSize : UINT64_MAX);
+    initPipeline(&p, opts->threads, true);
+    initRefTable(p.ref, header->flags & HUFF_FLAG_DICT ? dict : NULL);
+    thpool_t *pool = tp_init(opts->threads);
+    huff_status_t status = runPipeline(&p, pool, readCodeBatch, decodeBatch, writeTextBatch);
+    STATS_ADD(stats, bytesIn, sizeof(blockheader_t));
+    STATS_ADD(stats, bytesOut, p.decodedSize * sizeof(INBUF_T));
+    if (status == HUFF_OK && (header->flags & HUFF_FLAG_CONTENT_SIZE) && p.decodedSize * sizeof(INBUF_T) != header->contentSize) {
+        status = HUFF_ERR_CORRUPTED;
+    }
+
+    freePipeline(&p);
+    tp_free(&pool);
+    fout_close(&p.out);
+    *in = p.in;
+    return status;
+}
+
+huff_status_t decodeFile(FILE * const input, FILE * const output, const huffopts_t * const opts, const huffdict_t *dict, huffstats_t *stats) {
+    // printInfo(DECODING_START);
+    STATS_START(total);
+
+    fin_t in;
+    fin_open(&in, input);
+    fileheader_t header;
+    size_t got = 0;
+    const uint8_t *data = fin_read(&in, sizeof(header), (uint8_t*)&header, &got);
+    memmove(&header, data, got);
+    huff_status_t status = !got ? HUFF_ERR_EMPTY : HUFF_ERR_FORMAT;
+    if (got == sizeof(header)) {
+        STATS_ADD(stats, bytesIn, sizeof(header));
+        if (HUFF_SYMBOL_BITS == 8 && (header.flags & HUFF_FLAG_SYMBOL16)) {
+            status = decodeWideBlocks(&in, &header, output, opts, stats);
+        } else {
+            status = decodeBlocks(&in, &header, output, opts, dict, stats);
+        }
+    }
+    fin_close(&in);
+    STATS_LAP(stats, ST_TOTAL, total);
+    return status;
+}
+
+/**
+  @brief Calculates dictionary id
+
+  FNV-1a hash of the stored tables and their mode, never 0.
+  @param[in] tables uint8_t * Stored tables
+  @param[in] size size_t Size of the stored tables
+  @param[in] mode uint8_t Coding mode
+  @return Dictionary id
+*/
+static uint32_t dictId(const uint8_t *tables, size_t size, uint8_t mode) {
+    uint32_t hash = 2166136261u;
+    hash = (hash ^ mode) * 16777619u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ tables[i]) * 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+/**
+  Maximal size of the stored dictionary tables.
+*/
+#define DICT_TABLES_BOUND (CTX_MAX_TABLES * BLOCK_TABLE_BOUND + CTX_LIM * CTX_TABLES_BITS / CHAR_BIT + 1)
+
+huff_status_t trainDict(FILE * const input, FILE * const output, const huffopts_t * const opts) {
+    fin_t in;
+    fin_open(&in, input);
+    // sample is counted as one bitstream, as messages are encoded
+    huffopts_t sampleOpts = *opts;
+    sampleOpts.streams = 1;
+    blockscratch_t *scratch = (blockscratch_t*)s_calloc(1, sizeof(blockscratch_t));
+    blockscratch_t *total = (blockscratch_t*)s_calloc(1, sizeof(blockscratch_t));
+    INBUF_T *textBuf = in.map ? NULL : (INBUF_T*)s_malloc(opts->blockSize * sizeof(INBUF_T));
+    FILESIZE_T sampleSize = 0;
+    while (true) {
+        size_t got = 0;
+        const INBUF_T *text = (const INBUF_T*)fin_read(&in, opts->blockSize * sizeof(INBUF_T), (uint8_t*)textBuf, &got);
+        if (!got) {
+            break;
+        }
+        countBlockSymbols(text, got / sizeof(INBUF_T), &sampleOpts, scratch);
+        for (size_t i = 0; i < INBUF_T_LIM; i++) {
+            total->freqTable[i] += scratch->freqTable[i];
+            for (size_t ctx = 0; ctx < CTX_LIM && IS_CTX1(opts->mode); ctx++) {
+                total->ctxFreqTable[ctx][i] += scratch->ctxFreqTable[ctx][i];
+            }
+        }
+        sampleSize += got;
+    }
+    huff_status_t status = ferror(input) ? HUFF_ERR_IO : sampleSize ? HUFF_OK : HUFF_ERR_EMPTY;
+
+    if (status == HUFF_OK) {
+        // every symbol gets a code in every context, so any text can repeat the tables
+        for (size_t i = 0; i < INBUF_T_LIM; i++) {
+            total->freqTable[i]++;
+            for (size_t ctx = 0; ctx < CTX_LIM && IS_CTX1(opts->mode); ctx++) {
+                total->ctxFreqTable[ctx][i]++;
+            }
+        }
+        reftable_t *table = (reftable_t*)s_calloc(1, sizeof(reftable_t));
+        buildRefTable(table, &sampleOpts, total);
+        copyRefTable(table, total);
+        uint8_t tables[DICT_TABLES_BOUND + sizeof(uint64_t)];
+        bitwriter_t bw;
+        bw_init(&bw, tables);
+        writeCodeTables(&bw, total, opts->mode);
+        dictheader_t header = {HUFF_DICT_MAGIC, HUFF_FORMAT_VERSION, opts->mode, 0, 0, 0};
+        header.tablesSize = bw_finish(&bw) - tables;
+        header.id = dictId(tables, header.tablesSize, opts->mode);
+        if (fwrite(&header, sizeof(header), 1, output) != 1 || fwrite(tables, 1, header.tablesSize, output) != header.tablesSize) {
+            status = HUFF_ERR_IO;
+        }
+        free(table);
+    }
+    free(textBuf);
+    free(total);
+    free(scratch);
+    fin_close(&in);
+    return status;
+}
+
+huff_status_t readDict(const uint8_t *data, size_t size, huffdict_t *dict) {
+    dictheader_t header;
+    if (size < sizeof(header)) {
+        return HUFF_ERR_DICT;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, HUFF_DICT_MAGIC, sizeof(header.magic)) || header.version != HUFF_FORMAT_VERSION
+        || header.mode > MAX_MODE || header.tablesSize > DICT_TABLES_BOUND || header.tablesSize != size - sizeof(header)
+        || header.id != dictId(data + sizeof(header), header.tablesSize, header.mode)) {
+        return HUFF_ERR_DICT;
+    }
+    // bit reader peeks one word past the tables
+    uint8_t tables[DICT_TABLES_BOUND + sizeof(uint64_t)] = {0};
+    memcpy(tables, data + sizeof(header), header.tablesSize);
+    bitreader_t br;
+    br_init(&br, tables);
+    if (!readCodeTables(&br, header.tablesSize * CHAR_BIT, &dict->table, header.mode) || br.pos > header.tablesSize * CHAR_BIT) {
+        return HUFF_ERR_DICT;
+    }
+    dict->table.id = DICT_TABLE_ID;
+    dict->table.lastId = DICT_TABLE_ID;
+    dict->table.tableBits = codeTablesBits(&dict->table, header.mode);
+    dict->table.redundancy = 0;
+    dict->id = header.id;
+    dict->mode = header.mode;
+    dict->complete = true;
+    for (size_t ctx = 0; ctx < CTX_LIM; ctx++) {
+        for (size_t i = 0; i < INBUF_T_LIM; i++) {
+            dict->complete = dict->complete && dict->table.codeTable[dict->table.ctxMap[ctx]][i].len;
+        }
+    }
+    return HUFF_OK;
+}
+
+huff_status_t openIndexedFile(indexedfile_t *file, const uint8_t *data, size_t size, const huffopts_t *opts, const huffdict_t *dict) {
+    if (!size) {
+        return HUFF_ERR_EMPTY;
+    }
+    blockheader_t end;
+    indextrailer_t trailer;
+    if (size < sizeof(fileheader_t) + sizeof(end) + sizeof(trailer)) {
+        return HUFF_ERR_FORMAT;
+    }
+    memcpy(&file->header, data, sizeof(fileheader_t));
+    memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+    if (checkFileHeader(&file->header) != HUFF_OK || !(file->header.flags & HUFF_FLAG_INDEX)) {
+        return HUFF_ERR_FORMAT;
+    }
+    if (checkFileDict(&file->header, dict) != HUFF_OK) {
+        return HUFF_ERR_DICT;
+    }
+    if (memcmp(trailer.magic, HUFF_INDEX_MAGIC, sizeof(trailer.magic)) || trailer.blocks > INDEX_MAX_BLOCKS
+        || trailer.indexOffset < sizeof(fileheader_t) || trailer.indexOffset > size - sizeof(end)
+        || size - sizeof(end) - trailer.indexOffset != indexPayloadSize(trailer.blocks)) {
+        return HUFF_ERR_CORRUPTED;
+    }
+    memcpy(&end, data + trailer.indexOffset, sizeof(end));
+    if (end.rawSize || end.payloadSize != indexPayloadSize(trailer.blocks)) {
+        return HUFF_ERR_CORRUPTED;
+    }
+
+    file->data = data;
+    file->size = size;
+    file->opts = *opts;
+    getFileOpts(&file->opts, &file->header);
+    file->payloadBound = blockPayloadBound(file->header.blockSize, &file->opts);
+    file->indexOffset = trailer.indexOffset;
+    file->entries = data + trailer.indexOffset + sizeof(end);
+    file->blocks = trailer.blocks;
+    file->dict = file->header.flags & HUFF_FLAG_DICT ? dict : NULL;
+    file->contentSize = 0;
+    if (file->blocks) {
+        indexentry_t last;
+        memcpy(&last, file->entries + (file->blocks - 1) * sizeof(indexentry_t), sizeof(last));
+        file->contentSize = last.rawOffset + last.rawSize;
+    }
+    if ((file->header.flags & HUFF_FLAG_CONTENT_SIZE) && file->contentSize * sizeof(INBUF_T) != file->header.contentSize) {
+        return HUFF_ERR_CORRUPTED;
+    }
+    return HUFF_OK;
+}
+
+/**
+  @brief Reads entry of the block index
+
+  @param[in] file indexedfile_t * Opened file
+  @param[in] block uint32_t Number of the block, less than file->blocks
+  @param[out] entry indexentry_t * Entry of the block
+*/
+static void getIndexEntry(const indexedfile_t *file, uint32_t block, indexentry_t *entry) {
+    memcpy(entry, file->entries + (size_t)block * sizeof(indexentry_t), sizeof(indexentry_t));
+}
+
+/**
+  @brief Finds payload of the indexed block
+
+  @param[in] file indexedfile_t * Opened file
+  @param[in] entry indexentry_t * Index entry of the block
+  @param[out] block blockheader_t * Header of the block
+  @return Pointer to the encoded block, NULL if the block doesn't match the index
+*/
+static const uint8_t* getIndexedBlock(const indexedfile_t *file, const indexentry_t *entry, blockheader_t *block) {
+    if (entry->offset < sizeof(fileheader_t) || entry->offset > file->indexOffset - sizeof(blockheader_t)) {
+        return NULL;
+    }
+    memcpy(block, file->data + entry->offset, sizeof(blockheader_t));
+    // end block header always follows the payload, so bit reader may peek one word past it
+    if (!block->rawSize || block->rawSize != entry->rawSize || block->rawSize > file->header.blockSize
+        || block->payloadSize > file->payloadBound || block->payloadSize > file->indexOffset - entry->offset - sizeof(blockheader_t)) {
+        return NULL;
+    }
+    return file->data + entry->offset + sizeof(blockheader_t);
+}
+
+huff_status_t decodeRange(const indexedfile_t *file, uint64_t offset, uint64_t length, reftable_t *ref, blockscratch_t *scratch,
+                          INBUF_T *textBuf, rangewriter_t write, void *arg) {
+    if (offset >= file->contentSize || !length) {
+        return HUFF_OK;
+    }
+    uint64_t rangeEnd = length < file->contentSize - offset ? offset + length : file->contentSize;
+
+    // the last block starting before the range is found by binary search over the text positions
+    uint32_t first = 0;
+    uint32_t last = file->blocks - 1;
+    indexentry_t entry;
+    while (first < last) {
+        uint32_t middle = first + (last - first + 1) / 2;
+        getIndexEntry(file, middle, &entry);
+        if (entry.rawOffset <= offset) {
+            first = middle;
+        } else {
+            last = middle - 1;
+        }
+    }
+    getIndexEntry(file, first, &entry);
+    if (entry.tableBlock > first) {
+        return HUFF_ERR_CORRUPTED;
+    }
+
+    // chain of repeated tables starts from the block storing the table or from the dictionary
+    initRefTable(ref, file->dict);
+    blockheader_t block;
+    const uint8_t *payload;
+    if (entry.tableBlock < first) {
+        indexentry_t anchor;
+        getIndexEntry(file, entry.tableBlock, &anchor);
+        payload = getIndexedBlock(file, &anchor, &block);
+        if (!payload || !readBlockTable(payload, block.payloadSize, &file->opts, ref, scratch)) {
+            return HUFF_ERR_CORRUPTED;
+        }
+    }
+
+    uint64_t rawPos = entry.rawOffset;
+    for (uint32_t i = first; rawPos < rangeEnd; i++) {
+        if (i >= file->blocks) {
+            return HUFF_ERR_CORRUPTED;
+        }
+        getIndexEntry(file, i, &entry);
+        payload = getIndexedBlock(file, &entry, &block);
+        if (!payload || entry.rawOffset != rawPos || !readBlockTable(payload, block.payloadSize, &file->opts, ref, scratch)
+            || !decodeBlock(payload, block.payloadSize, textBuf, block.rawSize, scratch, &file->opts)) {
+            return HUFF_ERR_CORRUPTED;
+        }
+        if (blockChecksum(textBuf, block.rawSize) != block.checksum) {
+            return HUFF_ERR_CHECKSUM;
+        }
+        size_t textStart = offset > rawPos ? offset - rawPos : 0;
+        size_t textEnd = rangeEnd - rawPos < block.rawSize ? rangeEnd - rawPos : block.rawSize;
+        if (!write(arg, textBuf + textStart, textEnd - textStart)) {
+            return HUFF_ERR_IO;
+        }
+        rawPos += block.rawSize;
+    }
+    return HUFF_OK;
+}
+
+/**
+  @brief Writes decoded range text to the file
+
+  @param[in] arg FILE * Output file
+  @param[in] text INBUF_T * Decoded text
+  @param[in] size size_t Number of symbols
+  @return false if the text can't be written
+*/
+static bool writeRangeFile(void *arg, const INBUF_T *text, size_t size) {
+    return fwrite(text, sizeof(INBUF_T), size, (FILE*)arg) == size;
+}
+
+/**
+  @brief Decodes range of the mapped file to the output file
+
+  @param[in] data uint8_t * Whole encoded file
+  @param[in] size size_t Size of the encoded file
+  @param[in] output FILE * File to write decoded range to
+  @param[in] opts huffopts_t * Decoder options
+  @param[in] dict huffdict_t * Dictionary the file was encoded with, may be NULL
+  @param[in] offset uint64_t Position of the range in the original text in symbols
+  @param[in] length uint64_t Number of symbols of the range
+  @param[out] stats huffstats_t * Statistics to add to, may be NULL
+  @return HUFF_OK or error code
+*/
+static huff_status_t decodeMappedRange(const uint8_t *data, size_t size, FILE * const output, const huffopts_t * const opts,
+                                       const huffdict_t *dict, uint64_t offset, uint64_t length, huffstats_t *stats) {
+    (void)stats;
+    indexedfile_t file;
+    huff_status_t status = openIndexedFile(&file, data, size, opts, dict);
+    if (status == HUFF_OK) {
+        INBUF_T *textBuf = (INBUF_T*)s_malloc(file.header.blockSize * sizeof(INBUF_T));
+        reftable_t *ref = (reftable_t*)s_calloc(1, sizeof(reftable_t));
+        blockscratch_t *scratch = (blockscratch_t*)s_calloc(1, sizeof(blockscratch_t));
+        status = decodeRange(&file, offset, length, ref, scratch, textBuf, writeRangeFile, output);
+        if (status == HUFF_OK && ferror(output)) {
+            status = HUFF_ERR_IO;
+        }
+        STATS_ADD(stats, bytesOut, (offset < file.contentSize ? (length < file.contentSize - offset ? length : file.contentSize - offset) : 0)
+                                   * sizeof(INBUF_T));
+        STATS_MERGE(stats, &scratch->stats);
+        free(textBuf);
+        free(ref);
+        free(scratch);
+    }
+    return status;
+}
+
+huff_status_t decodeFileRange(FILE * const input, FILE * const output, const huffopts_t * const opts, const huffdict_t *dict,
+                              uint64_t offset, uint64_t length, huffstats_t *stats) {
+    STATS_START(total);
+
+    fin_t in;
+    fin_open(&in, input);
+    if (!in.map) {
+        // only mapped files can be read at random positions
+        huff_status_t status = fgetc(input) == EOF && !ferror(input) ? HUFF_ERR_EMPTY : HUFF_ERR_IO;
+        fin_close(&in);
+        return status;
+    }
+    const uint8_t *data = in.map + in.pos;
+    size_t size = fin_mapped(&in);
+    fileheader_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(&header, data, size < sizeof(header) ? size : sizeof(header));
+    huff_status_t status;
+    if (HUFF_SYMBOL_BITS == 8 && (header.flags & HUFF_FLAG_SYMBOL16)) {
+        status = decodeWideRange(data, size, output, opts, offset, length, stats);
+    } else {
+        status = decodeMappedRange(data, size, output, opts, dict, offset / sizeof(INBUF_T), length / sizeof(INBUF_T), stats);
+    }
+    fin_close(&in);
+    STATS_LAP(stats, ST_TOTAL, total);
+    return status;
+}
+
+#if HUFF_SYMBOL_BITS == 16
+huff_status_t encodeWideFile(FILE * const input, FILE * const output, const huffopts_t * const opts, huffstats_t *stats) {
+    return encodeFile(input, output, opts, NULL, stats);
+}
+
+huff_status_t estimateWideFile(FILE * const input, const huffopts_t * const opts, estimatewriter_t write, void *arg,
+                               huffestimate_t *estimate) {
+    return estimateFile(input, opts, NULL, write, arg, estimate);
+}
+
+huff_status_t decodeWideBlocks(fin_t *in, const fileheader_t *header, FILE * const output, const huffopts_t * const opts, huffstats_t *stats) {
+    return decodeBlocks(in, header, output, opts, NULL, stats);
+}
+
+huff_status_t decodeWideRange(const uint8_t *data, size_t size, FILE * const output, const huffopts_t * const opts,
+                              uint64_t offset, uint64_t length, huffstats_t *stats) {
+    if (offset % sizeof(INBUF_T) || length % sizeof(INBUF_T)) {
+        return HUFF_ERR_SYMBOL_SIZE;
+    }
+    return decodeMappedRange(data, size, output, opts, NULL, offset / sizeof(INBUF_T), length / sizeof(INBUF_T), stats);
 }
+#endif
@@ -9,22 +9,757 @@
 #ifndef HAFFMAN_H
 #define HAFFMAN_H
 
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include "btree.h"
+#include "fileio.h"
+#include "libhuff.h"
+#include "stats.h"
+#include "stdsafe.h"
+
+#define HUFF_MAGIC "HUF"
+#define HUFF_FORMAT_VERSION 12
+#define HUFF_INDEX_MAGIC "HIX"
+#define HUFF_DICT_MAGIC "HUD"
+
+/**
+  Width of the coded symbols in bits, 8 or 16.
+  Codec is compiled once for every width: huffman.c built with HUFF_SYMBOL_BITS=16 gets 16 suffix
+  on all its external functions, and the 8-bit instance passes files of 16-bit symbols to it.
+*/
+#ifndef HUFF_SYMBOL_BITS
+#define HUFF_SYMBOL_BITS 8
+#endif
+
+#if HUFF_SYMBOL_BITS == 16
+#define INBUF_T uint16_t
+#define getFreqTable getFreqTable16
+#define getCodeTable getCodeTable16
+#define blockPayloadBound blockPayloadBound16
+#define countBlockSymbols countBlockSymbols16
+#define selectCodeTable selectCodeTable16
+#define repeatRefTable repeatRefTable16
+#define encodeBlock encodeBlock16
+#define blockPayloadSize blockPayloadSize16
+#define estimateBlock estimateBlock16
+#define readBlockTable readBlockTable16
+#define preloadDecodeTables preloadDecodeTables16
+#define decodeBlock decodeBlock16
+#define blockChecksum blockChecksum16
+#define initFileHeader initFileHeader16
+#define checkFileHeader checkFileHeader16
+#define getFileOpts getFileOpts16
+#define checkFileDict checkFileDict16
+#define initRefTable initRefTable16
+#define trainDict trainDict16
+#define readDict readDict16
+#define addIndexEntry addIndexEntry16
+#define indexPayloadSize indexPayloadSize16
+#define writeIndex writeIndex16
+#define openIndexedFile openIndexedFile16
+#define decodeRange decodeRange16
+#define encodeFile encodeFile16
+#define decodeFile decodeFile16
+#define decodeFileRange decodeFileRange16
+#define estimateFile estimateFile16
+#elif HUFF_SYMBOL_BITS == 8
+#define INBUF_T uint8_t
+#else
+#error "HUFF_SYMBOL_BITS should be 8 or 16"
+#endif
+#define INBUF_T_SIZE (sizeof(INBUF_T)*CHAR_BIT)
+#define INBUF_T_LIM (1 << INBUF_T_SIZE)
+#define INBUF_T_MAX (INBUF_T_LIM - 1)
+#define OUTBUF_T __uint64_t
+#define OUTBUF_T_SIZE (sizeof(OUTBUF_T)*CHAR_BIT)
+#define OUTBUF_T_LIM (1 << OUTBUF_T_SIZE)
+#define OUTBUF_T_MAX (OUTBUF_T_LIM - 1)
+
+/**
+  Code length limit.
+  Bit reader peeks at least 57 bits, so longer codes can't be decoded.
+*/
+#define CODE_LEN_LIM 57
+
+/**
+  Encoded file header.
+*/
+typedef struct {
+    char magic[4];       /**< HUFF_MAGIC */
+    uint8_t version;     /**< HUFF_FORMAT_VERSION */
+    uint8_t flags;       /**< HUFF_FLAG_* bits */
+    uint8_t streams;     /**< number of interleaved bitstreams in every block */
+    uint8_t mode;        /**< coding mode, one of huff_mode_t */
+    uint32_t blockSize;  /**< maximal number of symbols of the original text block */
+    uint32_t dictId;     /**< id of the dictionary the file is encoded with if HUFF_FLAG_DICT is set */
+    uint64_t contentSize;  /**< size of the original text in bytes if HUFF_FLAG_CONTENT_SIZE is set */
+} fileheader_t;
+
+/**
+  File header flags.
+*/
+#define HUFF_FLAG_CONTENT_SIZE 1
+#define HUFF_FLAG_INDEX 2
+#define HUFF_FLAG_DICT 4
+#define HUFF_FLAG_SYMBOL16 8
+
+/**
+  Symbol width flag of the files coded by this instance of the codec.
+*/
+#define HUFF_SYMBOL_FLAG (HUFF_SYMBOL_BITS == 16 ? HUFF_FLAG_SYMBOL16 : 0)
+
+/**
+  Number of contexts and maximal number of code tables of the block in HUFF_MODE_CTX1.
+  Contexts are clustered to this number of tables, so their decoding tables stay in cache.
+  16-bit symbols are coded in HUFF_MODE_ORDER0 only, their blocks have a single context.
+*/
+#if HUFF_SYMBOL_BITS == 8
+#define CTX_LIM INBUF_T_LIM
+#define CTX_MAX_TABLES 8
+#else
+#define CTX_LIM 1
+#define CTX_MAX_TABLES 1
+#endif
+#define CTX_TABLES_BITS 3
+
+/**
+  Checks that the mode chooses code tables by the previous symbol.
+  Always false for 16-bit symbols, so their context code is compiled out.
+*/
+#define IS_CTX1(mode) (CTX_LIM > 1 && (mode) == HUFF_MODE_CTX1)
+/**
+  Last coding mode of the symbols.
+*/
+#define MAX_MODE (CTX_LIM > 1 ? HUFF_MODE_CTX1 : HUFF_MODE_ORDER0)
+
+/**
+  Encoded block types, stored in the first byte of the block payload.
+*/
+#define BLOCK_CODED 0   /**< huffman coded bitstreams */
+#define BLOCK_STORED 1  /**< original text, for blocks which don't shrink */
+#define BLOCK_RUN 2     /**< one symbol repeated through the whole block */
+
+/**
+  Encoded block header.
+  Block with zero rawSize marks the end of the file.
+*/
+typedef struct {
+    uint32_t rawSize;      /**< number of symbols of the original text block */
+    uint32_t payloadSize;  /**< size of the encoded block following the header */
+    uint32_t checksum;     /**< CRC32C of the original text block, 0 in the end block */
+} blockheader_t;
+
+/**
+  Dictionary file header.
+  Followed by the code tables written the same way as the tables of a block.
+*/
+typedef struct {
+    char magic[4];        /**< HUFF_DICT_MAGIC */
+    uint8_t version;      /**< HUFF_FORMAT_VERSION */
+    uint8_t mode;         /**< coding mode of the tables, one of huff_mode_t */
+    uint16_t reserved;    /**< reserved, 0 */
+    uint32_t id;          /**< dictionary id, hash of the stored tables */
+    uint32_t tablesSize;  /**< size of the stored tables in bytes */
+} dictheader_t;
+
+/**
+  Message header of huff_compressMessage output, followed by one single stream block.
+*/
+typedef struct {
+    uint32_t dictId;   /**< id of the dictionary the message is encoded with, 0 if none */
+    uint32_t rawSize;  /**< size of the original message */
+} messageheader_t;
+
+/**
+  Block index entry.
+  Index of all the blocks is the payload of the end block,
+  so any range of the text can be decoded without reading the blocks before it.
+*/
+typedef struct {
+    uint64_t offset;      /**< position of the block header in the encoded file */
+    uint64_t rawOffset;   /**< position of the block text in the original text in symbols */
+    uint32_t rawSize;     /**< number of symbols of the original text block */
+    uint32_t tableBlock;  /**< number of the block storing the code table this block uses */
+} indexentry_t;
+
+/**
+  Block index trailer, the last bytes of the encoded file if HUFF_FLAG_INDEX is set.
+*/
+typedef struct {
+    uint64_t indexOffset;  /**< position of the end block header, followed by the index entries */
+    uint32_t blocks;       /**< number of the index entries */
+    char magic[4];         /**< HUFF_INDEX_MAGIC */
+} indextrailer_t;
+
+/**
+  Maximal number of indexed blocks, the whole index should fit into the end block payload.
+*/
+#define INDEX_MAX_BLOCKS ((UINT32_MAX - sizeof(indextrailer_t)) / sizeof(indexentry_t))
+
+/**
+  Block index built by the encoder.
+*/
+typedef struct {
+    indexentry_t *entries;  /**< entries of the written blocks */
+    uint32_t count;         /**< number of the entries */
+    uint32_t capacity;      /**< number of the allocated entries */
+    uint32_t tableBlock;    /**< number of the last block storing its own code table */
+} blockindex_t;
+
+/**
+  Huffman table element.
+*/
+typedef struct {
+    uint64_t code;  /**< Huffman code of the symbol */
+    uint8_t len;    /**< Code length */
+} htdata_t;
+
+/**
+  Number of bits resolved by one decoding table lookup.
+  Larger alphabets have longer codes, so 16-bit symbols get larger table.
+*/
+#define DECODE_TABLE_BITS (HUFF_SYMBOL_BITS == 16 ? 13 : 11)
+#define DECODE_TABLE_SIZE (1 << DECODE_TABLE_BITS)
+
+/**
+  Decoding table element.
+*/
+typedef struct {
+    INBUF_T symb;  /**< decoded symbol */
+    uint8_t len;   /**< Code length, 0 for codes longer than DECODE_TABLE_BITS */
+} dtentry_t;
+
+/**
+  Decoding table.
+  Resolves codes up to DECODE_TABLE_BITS long with one lookup.
+  Longer codes are resolved using canonical code properties.
+*/
+typedef struct {
+    dtentry_t fast[DECODE_TABLE_SIZE];    /**< lookup table indexed by next DECODE_TABLE_BITS bits */
+    uint64_t firstCode[CODE_LEN_LIM + 1];  /**< first canonical code of every length */
+    uint32_t count[CODE_LEN_LIM + 1];      /**< number of codes of every length */
+    uint32_t offset[CODE_LEN_LIM + 1];     /**< index of the first symbol of every length in symbs */
+    INBUF_T symbs[INBUF_T_LIM];            /**< symbols sorted by code */
+    uint8_t maxLen;                        /**< maximal code length */
+} dtable_t;
+
+/**
+  Present symbol with its frequency, used to sort symbols.
+*/
+typedef struct {
+    FILESIZE_T freq;  /**< frequency of occurrence of the symbol */
+    size_t symb;      /**< symbol */
+} symbfreq_t;
+
+/**
+  Code construction scratch memory.
+  Huffman tree and length limiting lists of the whole alphabet, which is too large for the stack with 16-bit symbols.
+*/
+typedef struct {
+    btnode_t nodes[BT_NODES(INBUF_T_LIM)];  /**< huffman tree nodes */
+    bt_t tree;                              /**< huffman tree */
+    uint8_t depths[BT_NODES(INBUF_T_LIM)];  /**< depth of every tree node */
+    symbfreq_t leaves[INBUF_T_LIM];         /**< present symbols sorted by frequency */
+    symbfreq_t sortBuf[INBUF_T_LIM];        /**< radix sort buffer */
+    FILESIZE_T weights[2][2 * INBUF_T_LIM]; /**< weights of the previous and current package-merge level items */
+    bool isLeaf[HUFF_MAX_CODE_LEN][2 * INBUF_T_LIM];  /**< leaf flags of every package-merge level items */
+} codescratch_t;
+
+/**
+  Block coding scratch memory.
+  Tables of one block are built here, so coding of a block doesn't allocate memory for them.
+*/
+typedef struct {
+    FILESIZE_T freqTable[INBUF_T_LIM];  /**< symbol frequency table */
+    FILESIZE_T ctxFreqTable[CTX_LIM][INBUF_T_LIM];  /**< symbol frequency table of every previous symbol, HUFF_MODE_CTX1 only */
+    htdata_t codeTable[CTX_MAX_TABLES][INBUF_T_LIM];  /**< huffman code tables */
+    uint8_t ctxMap[CTX_LIM];            /**< code table of every previous symbol */
+    uint8_t tableCount;                 /**< number of code tables */
+    dtable_t dtable[CTX_MAX_TABLES];    /**< decoding tables */
+    uint32_t tableId;                   /**< id of the reference table copied to codeTable, 0 if none */
+    FILESIZE_T tableBits;               /**< size of the stored code tables in bits */
+    uint32_t decodeTableId;             /**< id of the table dtable is built for, 0 if none */
+    bool repeat;                        /**< block doesn't store its own table, coded block repeats the previous one */
+    uint8_t type;                       /**< block type, BLOCK_CODED blocks only use the code tables */
+    double entropy;                     /**< Shannon bound of the block text in the coding mode in bits */
+#ifdef HUFF_STATS
+    huffstats_t stats;                  /**< statistics of the blocks coded since the last merge */
+#endif
+} blockscratch_t;
+
+/**
+  Code table shared by consecutive blocks.
+  Block may repeat the table of the previous block instead of storing its own,
+  blocks of every file or buffer are chained through one reference table.
+  In HUFF_MODE_CTX1 it is the whole set of the context code tables.
+*/
+typedef struct {
+    htdata_t codeTable[CTX_MAX_TABLES][INBUF_T_LIM];  /**< canonical huffman code tables */
+    uint8_t ctxMap[CTX_LIM];          /**< code table of every previous symbol */
+    uint8_t tableCount;               /**< number of code tables */
+    uint32_t id;                      /**< number of the table, 0 if there is no table yet */
+    uint32_t lastId;                  /**< number of the last table, numbers are never reused */
+    FILESIZE_T tableBits;             /**< size of the stored code tables in bits */
+    double redundancy;                /**< excess of the code over the entropy of its own block in bits per symbol */
+    codescratch_t build;              /**< scratch memory of the encoder building new tables */
+} reftable_t;
+
+/**
+  Id of the reference table loaded from the dictionary.
+  Tables of the blocks get the following ids, so decoding tables of the dictionary are rebuilt only after they were replaced.
+*/
+#define DICT_TABLE_ID 1
+
+/**
+  Pre-trained code tables shared by the encoder and the decoder.
+  Every file or buffer encoded with the dictionary starts with its tables as the reference ones,
+  so blocks repeating them store only the repeat flag.
+*/
+typedef struct {
+    reftable_t table;  /**< code tables, DICT_TABLE_ID is their id */
+    uint32_t id;       /**< dictionary id stored in the encoded file header */
+    uint8_t mode;      /**< coding mode of the tables */
+    bool complete;     /**< every symbol has a code in every context, so any text can repeat the tables */
+} huffdict_t;
+
+/**
+  Encoded file opened for random access through its block index.
+*/
+typedef struct {
+    const uint8_t *data;     /**< whole encoded file */
+    size_t size;             /**< size of the encoded file */
+    fileheader_t header;     /**< file header */
+    huffopts_t opts;         /**< coding options of the file */
+    size_t payloadBound;     /**< maximal size of the encoded block */
+    uint64_t indexOffset;    /**< position of the end block header */
+    const uint8_t *entries;  /**< index entries, not aligned */
+    uint32_t blocks;         /**< number of the index entries */
+    uint64_t contentSize;    /**< number of symbols of the original text */
+    const huffdict_t *dict;  /**< dictionary of the file, NULL if it doesn't use one */
+} indexedfile_t;
+
+/**
+  Receiver of the decoded range text.
+  Gets pieces of the range in order, returns false if the text can't be written.
+*/
+typedef bool (*rangewriter_t)(void *arg, const INBUF_T *text, size_t size);
+
+/**
+  Receiver of the block estimates, gets them in the original order.
+*/
+typedef void (*estimatewriter_t)(void *arg, const huffestimate_t *block);
+
+/**
+  @brief Generates symbol frequency table
+
+  @param[in] inBuf INBUF_T * Pointer to the text buffer
+  @param[in] inBuf_size FILESIZE_T Size of the text buffer
+  @param[out] freqTable FILESIZE_T * Pointer to the symbol frequency table
+*/
+void getFreqTable(const INBUF_T *inBuf, FILESIZE_T inBuf_size, FILESIZE_T *freqTable);
+
+/**
+  @brief Generates huffman code table using symbol frequency table
+
+  Codes longer than maxLen are replaced by optimal length limited ones.
+  Limit is raised to the shortest one fitting all the present symbols of a large alphabet.
+  @param[in] freqTable FILESIZE_T * Pointer to the symbol frequency table
+  @param[out] codeTable htdata_t * Pointer to the huffman code table
+  @param[in] maxLen uint8_t Code length limit
+  @param[out] scratch codescratch_t * Scratch memory for the huffman tree and length limiting
+  @return Size of the encoded text in bits
+*/
+FILESIZE_T getCodeTable(const FILESIZE_T *freqTable, htdata_t *codeTable, uint8_t maxLen, codescratch_t *scratch);
+
+/**
+  @brief Calculates maximal size of the encoded block
+
+  Huffman code is never longer than the fixed length code, so the text can't grow.
+  @param[in] inBuf_size size_t Size of the text block
+  @param[in] opts huffopts_t * Coding options
+  @return Maximal size of the encoded block
+*/
+size_t blockPayloadBound(size_t inBuf_size, const huffopts_t *opts);
+
+/**
+  @brief Counts symbol frequencies of the block
+
+  In HUFF_MODE_CTX1 symbols are counted separately for every previous symbol,
+  the first symbol of every bitstream is counted as preceded by zero.
+  @param[in] inBuf INBUF_T * Pointer to the text block
+  @param[in] inBuf_size uint32_t Size of the text block
+  @param[in] opts huffopts_t * Encoder options
+  @param[out] scratch blockscratch_t * Scratch memory, gets the frequency tables
+*/
+void countBlockSymbols(const INBUF_T *inBuf, uint32_t inBuf_size, const huffopts_t *opts, blockscratch_t *scratch);
+
+/**
+  @brief Chooses type and code table of the block
+
+  Block of one symbol is stored as a run, and block whose entropy, together with the estimated size of its new order-0 table,
+  is less than STORED_MIN_GAIN bits per symbol below the original size is stored as is, neither of them needs a code table.
+  Coded block repeats the reference table if its cost is within TABLE_REUSE_SLACK of the estimated cost of the new table,
+  which exceeds the entropy of the block as much as the reference table did on its own block and needs its own header.
+  Otherwise new table is built and becomes the reference one.
+  In HUFF_MODE_CTX1 contexts with similar statistics are clustered, and every cluster gets its own table.
+  Blocks should be passed in the original order.
+  @param[in,out] ref reftable_t * Reference table
+  @param[in] opts huffopts_t * Encoder options
+  @param[in,out] scratch blockscratch_t * Scratch memory with the block frequency tables,
+                 gets the block type and the chosen code tables
+*/
+void selectCodeTable(reftable_t *ref, const huffopts_t *opts, blockscratch_t *scratch);
+
+/**
+  @brief Makes the block repeat the reference table without choosing
+
+  Used for the text which surely has codes in the reference table, like a complete dictionary.
+  @param[in] ref reftable_t * Reference table
+  @param[out] scratch blockscratch_t * Scratch memory, gets the reference table
+*/
+void repeatRefTable(const reftable_t *ref, blockscratch_t *scratch);
+
+/**
+  @brief Encodes one block of the text
+
+  Writes block type chosen by selectCodeTable, followed by the text of the stored block or the symbol of the run.
+  Coded block gets code lengths table or repeat flag followed by the encoded text.
+  Multistream block text is split into opts->streams equal segments, encoded into separate bitstreams.
+  The first bitstream starts with the table, and jump table with bitstreams sizes precedes them all.
+  @param[in] inBuf INBUF_T * Pointer to the text block
+  @param[in] inBuf_size uint32_t Size of the text block
+  @param[out] payload uint8_t * Buffer for the encoded block, at least blockPayloadBound(inBuf_size, opts) bytes
+  @param[in] opts huffopts_t * Encoder options
+  @param[in,out] scratch blockscratch_t * Scratch memory with the block code table
+  @return Size of the encoded block
+*/
+size_t encodeBlock(const INBUF_T *inBuf, uint32_t inBuf_size, uint8_t *payload, const huffopts_t *opts, blockscratch_t *scratch);
+
+/**
+  @brief Calculates size of the block encodeBlock would write, without encoding it
+
+  Single bitstream is sized by the counted frequencies, while the symbols of multistream block
+  are looked up in the code table once more, as every bitstream is padded to the byte on its own.
+  @param[in] inBuf INBUF_T * Pointer to the text block
+  @param[in] inBuf_size uint32_t Size of the text block
+  @param[in] opts huffopts_t * Encoder options
+  @param[in] scratch blockscratch_t * Scratch memory with the frequency tables and the code table chosen by selectCodeTable
+  @return Size of the encoded block
+*/
+size_t blockPayloadSize(const INBUF_T *inBuf, uint32_t inBuf_size, const huffopts_t *opts, const blockscratch_t *scratch);
+
+/**
+  @brief Adds the block to the estimate
+
+  @param[in] inBuf INBUF_T * Pointer to the text block
+  @param[in] inBuf_size uint32_t Size of the text block
+  @param[in] opts huffopts_t * Encoder options
+  @param[in] scratch blockscratch_t * Scratch memory with the block type and code table chosen by selectCodeTable
+  @param[in,out] estimate huffestimate_t * Estimate to add the block with its header to
+*/
+void estimateBlock(const INBUF_T *inBuf, uint32_t inBuf_size, const huffopts_t *opts, const blockscratch_t *scratch,
+                   huffestimate_t *estimate);
+
+/**
+  @brief Reads code table of the block
+
+  New table becomes the reference one, repeated table is taken from the reference one.
+  Stored blocks and runs keep the reference table for the next blocks.
+  Blocks should be passed in the original order.
+  @param[in] payload uint8_t * Pointer to the encoded block, followed by one more readable word
+  @param[in] payload_size size_t Size of the encoded block
+  @param[in] opts huffopts_t * Coding options of the file
+  @param[in,out] ref reftable_t * Reference table
+  @param[out] scratch blockscratch_t * Scratch memory, gets the block code table
+  @return true if the table is valid
+*/
+bool readBlockTable(const uint8_t *payload, size_t payload_size, const huffopts_t *opts, reftable_t *ref, blockscratch_t *scratch);
+
+/**
+  @brief Builds decoding tables of the reference table ahead of decoding
+
+  @param[in] ref reftable_t * Reference table
+  @param[out] scratch blockscratch_t * Scratch memory, gets the table and its decoding tables
+*/
+void preloadDecodeTables(const reftable_t *ref, blockscratch_t *scratch);
+
+/**
+  @brief Decodes one block of the text
+
+  Uses the table read by readBlockTable, decoding table is rebuilt only if the table changed.
+  Stored blocks are copied and runs are filled without any table.
+  @param[in] payload uint8_t * Pointer to the encoded block, followed by one more readable word
+  @param[in] payload_size size_t Size of the encoded block
+  @param[out] outBuf INBUF_T * Buffer for the decoded text
+  @param[in] outBuf_size uint32_t Size of the decoded text
+  @param[in,out] scratch blockscratch_t * Scratch memory with the block code table
+  @param[in] opts huffopts_t * Coding options of the file
+  @return true if the block was decoded successfully
+*/
+bool decodeBlock(const uint8_t *payload, size_t payload_size, INBUF_T *outBuf, uint32_t outBuf_size, blockscratch_t *scratch, const huffopts_t *opts);
+
+/**
+  @brief Calculates checksum of the text block stored in its header
+
+  @param[in] text INBUF_T * Pointer to the text block
+  @param[in] size uint32_t Size of the text block
+  @return CRC32C of the block
+*/
+uint32_t blockChecksum(const INBUF_T *text, uint32_t size);
+
+/**
+  @brief Fills encoded file header
+
+  @param[out] header fileheader_t * Header to fill
+  @param[in] opts huffopts_t * Encoder options
+*/
+void initFileHeader(fileheader_t *header, const huffopts_t *opts);
+
+/**
+  @brief Checks encoded file header
+
+  Files of the other symbol width are rejected, they are decoded by the other instance of the codec.
+  @param[in] header fileheader_t * Header to check
+  @return HUFF_OK or HUFF_ERR_FORMAT
+*/
+huff_status_t checkFileHeader(const fileheader_t *header);
+
+/**
+  @brief Takes coding options of the file from its header
+
+  @param[out] opts huffopts_t * Options to fill, threads and code length limit are kept
+  @param[in] header fileheader_t * Checked file header
+*/
+void getFileOpts(huffopts_t *opts, const fileheader_t *header);
+
+/**
+  @brief Checks that the file can be decoded with the dictionary
+
+  @param[in] header fileheader_t * Checked file header
+  @param[in] dict huffdict_t * Dictionary, may be NULL
+  @return HUFF_OK or HUFF_ERR_DICT if the file needs another dictionary
+*/
+huff_status_t checkFileDict(const fileheader_t *header, const huffdict_t *dict);
+
+/**
+  @brief Sets up the reference table for the first block of the file
+
+  Files encoded with a dictionary start from its tables, others start without a table.
+  Tables numbers are never reused, so the dictionary tables are copied only if some block replaced them.
+  @param[in,out] ref reftable_t * Reference table
+  @param[in] dict huffdict_t * Dictionary of the file, NULL if it doesn't use one
+*/
+void initRefTable(reftable_t *ref, const huffdict_t *dict);
+
+/**
+  @brief Builds dictionary from the sample texts
+
+  Code tables are built for the symbol frequencies of the whole sample in opts->mode,
+  every symbol is counted once more, so any text can be encoded with them.
+  @param[in] input FILE * Sample file
+  @param[in] output FILE * File to write the dictionary to
+  @param[in] opts huffopts_t * Encoder options
+  @return HUFF_OK or error code
+*/
+huff_status_t trainDict(FILE * const input, FILE * const output, const huffopts_t * const opts);
+
+/**
+  @brief Reads dictionary file
+
+  @param[in] data uint8_t * Dictionary file content
+  @param[in] size size_t Size of the dictionary file
+  @param[out] dict huffdict_t * Dictionary
+  @return HUFF_OK or HUFF_ERR_DICT if the dictionary is invalid
+*/
+huff_status_t readDict(const uint8_t *data, size_t size, huffdict_t *dict);
+
+/**
+  @brief Appends the written block to the index
+
+  @param[in,out] index blockindex_t * Index to append to, zero initialized for the first block
+  @param[in] offset uint64_t Position of the block header in the encoded file
+  @param[in] rawSize uint32_t Size of the original text block
+  @param[in] repeat bool Block repeats the code table of the previous block
+  @return HUFF_OK, HUFF_ERR_MEMORY or HUFF_ERR_PARAM if there are too many blocks
+*/
+huff_status_t addIndexEntry(blockindex_t *index, uint64_t offset, uint32_t rawSize, bool repeat);
+
+/**
+  @brief Calculates size of the index stored in the end block
+
+  @param[in] blocks uint32_t Number of the indexed blocks
+  @return Size of the index entries and the trailer
+*/
+size_t indexPayloadSize(uint32_t blocks);
+
+/**
+  @brief Writes index entries followed by the trailer
+
+  @param[in] index blockindex_t * Index of all the blocks
+  @param[in] indexOffset uint64_t Position of the end block header
+  @param[out] out uint8_t * Buffer of indexPayloadSize(index->count) bytes
+*/
+void writeIndex(const blockindex_t *index, uint64_t indexOffset, uint8_t *out);
+
+/**
+  @brief Opens encoded file for random access
+
+  Checks the header, the trailer and the end block holding the index, blocks are checked when they are decoded.
+  @param[out] file indexedfile_t * File to initialize
+  @param[in] data uint8_t * Whole encoded file
+  @param[in] size size_t Size of the encoded file
+  @param[in] opts huffopts_t * Decoder options
+  @param[in] dict huffdict_t * Dictionary, may be NULL
+  @return HUFF_OK or error code
+*/
+huff_status_t openIndexedFile(indexedfile_t *file, const uint8_t *data, size_t size, const huffopts_t *opts, const huffdict_t *dict);
+
+/**
+  @brief Decodes range of the original text
+
+  Only the blocks overlapping the range are decoded, starting from the table of the first one,
+  which may be stored in one of the previous blocks.
+  Range is clipped to the end of the text.
+  @param[in] file indexedfile_t * Opened file
+  @param[in] offset uint64_t Position of the range in the original text
+  @param[in] length uint64_t Size of the range
+  @param[out] ref reftable_t * Reference table, reset before decoding
+  @param[out] scratch blockscratch_t * Scratch memory
+  @param[out] textBuf INBUF_T * Buffer for one decoded block, at least file->header.blockSize symbols
+  @param[in] write rangewriter_t Receiver of the decoded text
+  @param[in] arg void * Argument passed to the receiver
+  @return HUFF_OK or error code
+*/
+huff_status_t decodeRange(const indexedfile_t *file, uint64_t offset, uint64_t length, reftable_t *ref, blockscratch_t *scratch,
+                          INBUF_T *textBuf, rangewriter_t write, void *arg);
 
 /**
   @brief Huffman code encoder
 
+  Splits the input into blocks of opts->blockSize symbols and encodes them on opts->threads threads.
+  Input of 16-bit symbols is encoded by the 16-bit instance of the codec.
+  Only a few blocks per thread are kept in memory, so memory usage doesn't depend on the file size.
+  Output doesn't depend on the number of threads.
+  Regular input files are mapped to memory and encoded without copying.
+  Index of the blocks is stored in the end block, so the file can be decoded partially.
   @param[in] input FILE * File to encode
   @param[in] output FILE * File to write code to
+  @param[in] opts huffopts_t * Encoder options, mode should be the dictionary one
+  @param[in] dict huffdict_t * Dictionary to start from, may be NULL
+  @param[out] stats huffstats_t * Statistics to add to, may be NULL
+  @return HUFF_OK or error code
 */
-void encodeFile(FILE * const input, FILE * const output);
+huff_status_t encodeFile(FILE * const input, FILE * const output, const huffopts_t * const opts, const huffdict_t *dict, huffstats_t *stats);
 
 /**
   @brief Huffman code decoder
 
+  Decodes the input block by block on opts->threads threads.
+  Output file opened for reading and writing is mapped to memory and decoded in place.
+  Every decoded block is verified against its checksum. Without the output the blocks are decoded
+  into the reused buffers and only verified.
+  Files of 16-bit symbols are decoded by the 16-bit instance of the codec.
+
   @param[in] input FILE * File to decode
-  @param[in] output FILE * File to write decoded text to
+  @param[in] output FILE * File to write decoded text to, NULL to only verify the input
+  @param[in] opts huffopts_t * Decoder options, block size is taken from the input
+  @param[in] dict huffdict_t * Dictionary the file was encoded with, may be NULL
+  @param[out] stats huffstats_t * Statistics to add to, may be NULL
+  @return HUFF_OK or error code
+*/
+huff_status_t decodeFile(FILE * const input, FILE * const output, const huffopts_t * const opts, const huffdict_t *dict, huffstats_t *stats);
+
+/**
+  @brief Huffman code range decoder
+
+  Decodes only the blocks overlapping the range on one thread,
+  so reading a range costs time proportional to its size rather than the file size.
+  Input should be a regular file, it is mapped to memory.
+  Range of the file of 16-bit symbols should start and end at whole symbols.
+  @param[in] input FILE * File to decode
+  @param[in] output FILE * File to write decoded range to
+  @param[in] opts huffopts_t * Decoder options, block size is taken from the input
+  @param[in] dict huffdict_t * Dictionary the file was encoded with, may be NULL
+  @param[in] offset uint64_t Position of the range in the original text in bytes
+  @param[in] length uint64_t Size of the range in bytes, clipped to the end of the text
+  @param[out] stats huffstats_t * Statistics to add to, may be NULL
+  @return HUFF_OK or error code
+*/
+huff_status_t decodeFileRange(FILE * const input, FILE * const output, const huffopts_t * const opts, const huffdict_t *dict,
+                              uint64_t offset, uint64_t length, huffstats_t *stats);
+
+/**
+  @brief Huffman code size estimator
+
+  Counts symbols and chooses code tables of the blocks like encodeFile, but writes nothing,
+  so the estimate takes about the time of counting symbols and matches the encoded file size exactly.
+  Input of 16-bit symbols is estimated by the 16-bit instance of the codec.
+  @param[in] input FILE * File to estimate
+  @param[in] opts huffopts_t * Encoder options, mode should be the dictionary one
+  @param[in] dict huffdict_t * Dictionary to start from, may be NULL
+  @param[in] write estimatewriter_t Receiver of every block estimate, may be NULL
+  @param[in] arg void * Argument of the receiver
+  @param[out] estimate huffestimate_t * Estimate of the whole file
+  @return HUFF_OK or error code
+*/
+huff_status_t estimateFile(FILE * const input, const huffopts_t * const opts, const huffdict_t *dict,
+                           estimatewriter_t write, void *arg, huffestimate_t *estimate);
+
+/**
+  @brief Encodes file of 16-bit symbols
+
+  Entry of the 16-bit instance of the codec, takes no width dependent types.
+  @param[in] input FILE * File to encode
+  @param[in] output FILE * File to write code to
+  @param[in] opts huffopts_t * Encoder options
+  @param[out] stats huffstats_t * Statistics to add to, may be NULL
+  @return HUFF_OK or error code
+*/
+huff_status_t encodeWideFile(FILE * const input, FILE * const output, const huffopts_t * const opts, huffstats_t *stats);
+
+/**
+  @brief Decodes blocks of the file of 16-bit symbols
+
+  Entry of the 16-bit instance of the codec, takes no width dependent types.
+  @param[in,out] in fin_t * Input positioned after the file header
+  @param[in] header fileheader_t * File header with HUFF_FLAG_SYMBOL16 set
+  @param[in] output FILE * File to write decoded text to, NULL to only verify the input
+  @param[in] opts huffopts_t * Decoder options
+  @param[out] stats huffstats_t * Statistics to add to, may be NULL
+  @return HUFF_OK or error code
+*/
+huff_status_t decodeWideBlocks(fin_t *in, const fileheader_t *header, FILE * const output, const huffopts_t * const opts, huffstats_t *stats);
+
+/**
+  @brief Decodes range of the mapped file of 16-bit symbols
+
+  Entry of the 16-bit instance of the codec, takes no width dependent types.
+  @param[in] data uint8_t * Whole encoded file
+  @param[in] size size_t Size of the encoded file
+  @param[in] output FILE * File to write decoded range to
+  @param[in] opts huffopts_t * Decoder options
+  @param[in] offset uint64_t Position of the range in the original text in bytes
+  @param[in] length uint64_t Size of the range in bytes
+  @param[out] stats huffstats_t * Statistics to add to, may be NULL
+  @return HUFF_OK, HUFF_ERR_SYMBOL_SIZE if the range splits a symbol, or error code
+*/
+huff_status_t decodeWideRange(const uint8_t *data, size_t size, FILE * const output, const huffopts_t * const opts,
+                              uint64_t offset, uint64_t length, huffstats_t *stats);
+
+/**
+  @brief Estimates file of 16-bit symbols
+
+  Entry of the 16-bit instance of the codec, takes no width dependent types.
+  @param[in] input FILE * File to estimate
+  @param[in] opts huffopts_t * Encoder options
+  @param[in] write estimatewriter_t Receiver of every block estimate, may be NULL
+  @param[in] arg void * Argument of the receiver
+  @param[out] estimate huffestimate_t * Estimate of the whole file
+  @return HUFF_OK or error code
 */
-void decodeFile(FILE * const input, FILE * const output);
+huff_status_t estimateWideFile(FILE * const input, const huffopts_t * const opts, estimatewriter_t write, void *arg,
+                               huffestimate_t *estimate);
 
 #endif /* end of include guard: HAFFMAN_H */
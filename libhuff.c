@@ -0,0 +1,453 @@
+/**
+  @file libhuff.c
+  @brief Huffman compression library interface
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#include "libhuff.h"
+#include <stdlib.h>
+#include <string.h>
+#include "huffman.h"
+#include "msg.h"
+
+/**
+  Compression context.
+*/
+struct huffCtx {
+    huffopts_t opts;           /**< encoder options */
+    blockscratch_t scratch;    /**< block tables */
+    reftable_t ref;            /**< table repeated by the following blocks */
+    uint8_t *payloadBuf;       /**< encoded block buffer for the output without enough free space */
+    size_t payloadBuf_size;    /**< size of the encoded block buffer */
+    blockindex_t index;        /**< index of the compressed blocks */
+    huffdict_t *dict;          /**< loaded dictionary, NULL if none */
+    INBUF_T *textBuf;          /**< decoded block buffer for range decompression */
+    size_t textBuf_size;       /**< size of the decoded block buffer */
+};
+
+/**
+  Output buffer of the decoded range.
+*/
+typedef struct {
+    INBUF_T *text;  /**< output buffer */
+    size_t size;    /**< number of symbols written */
+} rangebuf_t;
+
+/**
+  @brief Forgets tables of the previous buffer
+
+  Every buffer starts a new chain of repeated tables, either from the dictionary tables or without a table.
+  @param[in] ctx huff_ctx_t * Context
+  @param[in] dict huffdict_t * Dictionary of the buffer, NULL if it doesn't use one
+*/
+static void resetTables(huff_ctx_t *ctx, const huffdict_t *dict) {
+    initRefTable(&ctx->ref, dict);
+    ctx->index.count = 0;
+}
+
+/**
+  @brief Gets the context buffer for the encoded block
+
+  @param[in] ctx huff_ctx_t * Context
+  @param[in] size size_t Required size
+  @return Buffer, NULL if memory can't be allocated
+*/
+static uint8_t* reservePayloadBuf(huff_ctx_t *ctx, size_t size) {
+    if (ctx->payloadBuf_size < size) {
+        uint8_t *buf = (uint8_t*)realloc(ctx->payloadBuf, size);
+        if (!buf) {
+            return NULL;
+        }
+        ctx->payloadBuf = buf;
+        ctx->payloadBuf_size = size;
+    }
+    return ctx->payloadBuf;
+}
+
+/**
+  @brief Copies decoded range text to the output buffer
+
+  @param[in] arg rangebuf_t * Output buffer with room for the whole range
+  @param[in] text INBUF_T * Decoded text
+  @param[in] size size_t Number of symbols
+  @return true
+*/
+static bool copyRange(void *arg, const INBUF_T *text, size_t size) {
+    rangebuf_t *buf = (rangebuf_t*)arg;
+    memcpy(buf->text + buf->size, text, size * sizeof(INBUF_T));
+    buf->size += size;
+    return true;
+}
+
+void huff_initOpts(huffopts_t *opts) {
+    *opts = (huffopts_t){HUFF_DEFAULT_BLOCK_SIZE, 1, HUFF_DEFAULT_CODE_LEN, 1, HUFF_MODE_ORDER0, 8};
+}
+
+huff_status_t huff_checkOpts(const huffopts_t *opts) {
+    if (opts->blockSize < HUFF_MIN_BLOCK_SIZE || opts->blockSize > HUFF_MAX_BLOCK_SIZE
+        || !opts->threads || opts->threads > HUFF_MAX_THREADS
+        || opts->maxCodeLen < HUFF_MIN_CODE_LEN || opts->maxCodeLen > HUFF_MAX_CODE_LEN
+        || !opts->streams || opts->streams > HUFF_MAX_STREAMS || opts->mode > HUFF_MODE_CTX1
+        || (opts->symbolBits != 8 && opts->symbolBits != 16) || (opts->symbolBits == 16 && opts->mode != HUFF_MODE_ORDER0)) {
+        return HUFF_ERR_PARAM;
+    }
+    return HUFF_OK;
+}
+
+huff_ctx_t* huff_init(const huffopts_t *opts) {
+    huffopts_t defaults;
+    if (!opts) {
+        huff_initOpts(&defaults);
+        opts = &defaults;
+    }
+    if (huff_checkOpts(opts) != HUFF_OK || opts->symbolBits != INBUF_T_SIZE) {
+        return NULL;
+    }
+    huff_ctx_t *ctx = (huff_ctx_t*)calloc(1, sizeof(huff_ctx_t));
+    if (ctx) {
+        ctx->opts = *opts;
+    }
+    return ctx;
+}
+
+void huff_free(huff_ctx_t **ctx) {
+    if (*ctx) {
+        free((*ctx)->payloadBuf);
+        free((*ctx)->index.entries);
+        free((*ctx)->textBuf);
+        free((*ctx)->dict);
+        free(*ctx);
+        *ctx = NULL;
+    }
+}
+
+size_t huff_compressBound(const huff_ctx_t *ctx, size_t srcSize) {
+    size_t blockSize = ctx->opts.blockSize;
+    size_t blocks = (srcSize + blockSize - 1) / blockSize;
+    size_t bound = sizeof(fileheader_t) + sizeof(blockheader_t) + sizeof(indextrailer_t) + blocks * sizeof(indexentry_t);
+    bound += srcSize / blockSize * (sizeof(blockheader_t) + blockPayloadBound(blockSize, &ctx->opts));
+    if (srcSize % blockSize) {
+        bound += sizeof(blockheader_t) + blockPayloadBound(srcSize % blockSize, &ctx->opts);
+    }
+    return bound;
+}
+
+huff_status_t huff_compress(huff_ctx_t *ctx, const void *src, size_t srcSize, void *dst, size_t dstCapacity, size_t *dstSize) {
+    const INBUF_T *text = (const INBUF_T*)src;
+    uint8_t *out = (uint8_t*)dst;
+    size_t pos = sizeof(fileheader_t);
+    *dstSize = 0;
+    if (dstCapacity < pos + sizeof(blockheader_t)) {
+        return HUFF_ERR_DST_SIZE;
+    }
+    fileheader_t header;
+    initFileHeader(&header, &ctx->opts);
+    header.flags |= HUFF_FLAG_CONTENT_SIZE;
+    header.contentSize = srcSize;
+    if (ctx->dict) {
+        header.flags |= HUFF_FLAG_DICT;
+        header.dictId = ctx->dict->id;
+    }
+    memcpy(out, &header, sizeof(header));
+    resetTables(ctx, ctx->dict);
+
+    for (size_t offset = 0; offset < srcSize; offset += ctx->opts.blockSize) {
+        blockheader_t block = {srcSize - offset < ctx->opts.blockSize ? srcSize - offset : ctx->opts.blockSize, 0, 0};
+        size_t bound = blockPayloadBound(block.rawSize, &ctx->opts);
+        pos += sizeof(blockheader_t);
+
+        // block is encoded in place if the output has room for the worst case
+        uint8_t *payload = out + pos;
+        if (dstCapacity - pos < bound && !(payload = reservePayloadBuf(ctx, bound))) {
+            return HUFF_ERR_MEMORY;
+        }
+        countBlockSymbols(text + offset, block.rawSize, &ctx->opts, &ctx->scratch);
+        selectCodeTable(&ctx->ref, &ctx->opts, &ctx->scratch);
+        huff_status_t status = addIndexEntry(&ctx->index, pos - sizeof(blockheader_t), block.rawSize, ctx->scratch.repeat);
+        if (status != HUFF_OK) {
+            return status;
+        }
+        block.payloadSize = encodeBlock(text + offset, block.rawSize, payload, &ctx->opts, &ctx->scratch);
+        block.checksum = blockChecksum(text + offset, block.rawSize);
+        if (dstCapacity - pos < block.payloadSize + sizeof(blockheader_t)) {
+            return HUFF_ERR_DST_SIZE;
+        }
+        if (payload != out + pos) {
+            memcpy(out + pos, payload, block.payloadSize);
+        }
+        memcpy(out + pos - sizeof(blockheader_t), &block, sizeof(block));
+        pos += block.payloadSize;
+    }
+
+    // zero sized block marks the end of the stream and holds the block index
+    blockheader_t end = {0, indexPayloadSize(ctx->index.count), 0};
+    if (dstCapacity - pos < sizeof(end) + end.payloadSize) {
+        return HUFF_ERR_DST_SIZE;
+    }
+    memcpy(out + pos, &end, sizeof(end));
+    writeIndex(&ctx->index, pos, out + pos + sizeof(end));
+    *dstSize = pos + sizeof(end) + end.payloadSize;
+    return HUFF_OK;
+}
+
+huff_status_t huff_estimate(huff_ctx_t *ctx, const void *src, size_t srcSize, huffestimate_t *estimate) {
+    const INBUF_T *text = (const INBUF_T*)src;
+    memset(estimate, 0, sizeof(*estimate));
+    estimate->encodedSize = sizeof(fileheader_t);
+    resetTables(ctx, ctx->dict);
+    for (size_t offset = 0; offset < srcSize; offset += ctx->opts.blockSize) {
+        uint32_t rawSize = srcSize - offset < ctx->opts.blockSize ? srcSize - offset : ctx->opts.blockSize;
+        countBlockSymbols(text + offset, rawSize, &ctx->opts, &ctx->scratch);
+        selectCodeTable(&ctx->ref, &ctx->opts, &ctx->scratch);
+        estimateBlock(text + offset, rawSize, &ctx->opts, &ctx->scratch, estimate);
+    }
+    // end block holds the index of all the blocks
+    estimate->encodedSize += sizeof(blockheader_t) + indexPayloadSize(estimate->blocks);
+    return HUFF_OK;
+}
+
+huff_status_t huff_decompress(huff_ctx_t *ctx, const void *src, size_t srcSize, void *dst, size_t dstCapacity, size_t *dstSize) {
+    const uint8_t *in = (const uint8_t*)src;
+    INBUF_T *text = (INBUF_T*)dst;
+    *dstSize = 0;
+    if (!srcSize) {
+        return HUFF_ERR_EMPTY;
+    }
+    fileheader_t header;
+    if (srcSize < sizeof(header)) {
+        return HUFF_ERR_FORMAT;
+    }
+    memcpy(&header, in, sizeof(header));
+    if (checkFileHeader(&header) != HUFF_OK) {
+        return HUFF_ERR_FORMAT;
+    }
+    if (checkFileDict(&header, ctx->dict) != HUFF_OK) {
+        return HUFF_ERR_DICT;
+    }
+    huffopts_t fileOpts = ctx->opts;
+    getFileOpts(&fileOpts, &header);
+    size_t payload_bound = blockPayloadBound(header.blockSize, &fileOpts);
+
+    size_t pos = sizeof(header);
+    resetTables(ctx, header.flags & HUFF_FLAG_DICT ? ctx->dict : NULL);
+    size_t decodedSize = 0;
+    while (true) {
+        blockheader_t block;
+        if (srcSize - pos < sizeof(block)) {
+            return HUFF_ERR_CORRUPTED;
+        }
+        memcpy(&block, in + pos, sizeof(block));
+        pos += sizeof(block);
+        // end block holds the block index
+        if (!block.rawSize) {
+            if (srcSize - pos < block.payloadSize) {
+                return HUFF_ERR_CORRUPTED;
+            }
+            break;
+        }
+        // the next block header always follows the payload, so bit reader may peek one word past it
+        if (block.rawSize > header.blockSize || block.payloadSize > payload_bound
+            || srcSize - pos < block.payloadSize + sizeof(blockheader_t)) {
+            return HUFF_ERR_CORRUPTED;
+        }
+        if (dstCapacity - decodedSize < block.rawSize) {
+            return HUFF_ERR_DST_SIZE;
+        }
+        if (!readBlockTable(in + pos, block.payloadSize, &fileOpts, &ctx->ref, &ctx->scratch)
+            || !decodeBlock(in + pos, block.payloadSize, text + decodedSize, block.rawSize, &ctx->scratch, &fileOpts)) {
+            return HUFF_ERR_CORRUPTED;
+        }
+        if (blockChecksum(text + decodedSize, block.rawSize) != block.checksum) {
+            return HUFF_ERR_CHECKSUM;
+        }
+        pos += block.payloadSize;
+        decodedSize += block.rawSize;
+    }
+    if ((header.flags & HUFF_FLAG_CONTENT_SIZE) && decodedSize != header.contentSize) {
+        return HUFF_ERR_CORRUPTED;
+    }
+    *dstSize = decodedSize;
+    return HUFF_OK;
+}
+
+huff_status_t huff_decompressRange(huff_ctx_t *ctx, const void *src, size_t srcSize, uint64_t offset, size_t length,
+                                   void *dst, size_t dstCapacity, size_t *dstSize) {
+    *dstSize = 0;
+    indexedfile_t file;
+    huff_status_t status = openIndexedFile(&file, (const uint8_t*)src, srcSize, &ctx->opts, ctx->dict);
+    if (status != HUFF_OK) {
+        return status;
+    }
+    uint64_t rangeSize = offset < file.contentSize ? file.contentSize - offset : 0;
+    rangeSize = length < rangeSize ? length : rangeSize;
+    if (dstCapacity < rangeSize) {
+        return HUFF_ERR_DST_SIZE;
+    }
+    if (ctx->textBuf_size < file.header.blockSize) {
+        INBUF_T *buf = (INBUF_T*)realloc(ctx->textBuf, file.header.blockSize * sizeof(INBUF_T));
+        if (!buf) {
+            return HUFF_ERR_MEMORY;
+        }
+        ctx->textBuf = buf;
+        ctx->textBuf_size = file.header.blockSize;
+    }
+    rangebuf_t range = {(INBUF_T*)dst, 0};
+    status = decodeRange(&file, offset, length, &ctx->ref, &ctx->scratch, ctx->textBuf, copyRange, &range);
+    if (status == HUFF_OK) {
+        *dstSize = range.size;
+    }
+    return status;
+}
+
+huff_status_t huff_loadDict(huff_ctx_t *ctx, const void *dict, size_t dictSize) {
+    huffdict_t *loaded = (huffdict_t*)malloc(sizeof(huffdict_t));
+    if (!loaded) {
+        return HUFF_ERR_MEMORY;
+    }
+    huff_status_t status = readDict((const uint8_t*)dict, dictSize, loaded);
+    if (status != HUFF_OK) {
+        free(loaded);
+        return status;
+    }
+    free(ctx->dict);
+    ctx->dict = loaded;
+    ctx->opts.mode = loaded->mode;
+    // tables of the previous dictionary had the same id
+    ctx->ref.id = 0;
+    ctx->scratch.tableId = 0;
+    ctx->scratch.decodeTableId = 0;
+    resetTables(ctx, ctx->dict);
+    preloadDecodeTables(&ctx->ref, &ctx->scratch);
+    return HUFF_OK;
+}
+
+/**
+  @brief Gets options of the message blocks
+
+  Message is a single block of one bitstream.
+  @param[in] ctx huff_ctx_t * Context
+  @param[out] opts huffopts_t * Options to fill
+*/
+static void getMessageOpts(const huff_ctx_t *ctx, huffopts_t *opts) {
+    *opts = ctx->opts;
+    opts->streams = 1;
+}
+
+size_t huff_messageBound(const huff_ctx_t *ctx, size_t srcSize) {
+    huffopts_t msgOpts;
+    getMessageOpts(ctx, &msgOpts);
+    return sizeof(messageheader_t) + blockPayloadBound(srcSize, &msgOpts);
+}
+
+huff_status_t huff_compressMessage(huff_ctx_t *ctx, const void *src, size_t srcSize, void *dst, size_t dstCapacity, size_t *dstSize) {
+    const INBUF_T *text = (const INBUF_T*)src;
+    uint8_t *out = (uint8_t*)dst;
+    *dstSize = 0;
+    if (srcSize > HUFF_MAX_BLOCK_SIZE) {
+        return HUFF_ERR_PARAM;
+    }
+    if (dstCapacity < sizeof(messageheader_t)) {
+        return HUFF_ERR_DST_SIZE;
+    }
+    messageheader_t header = {ctx->dict ? ctx->dict->id : 0, srcSize};
+    memcpy(out, &header, sizeof(header));
+    if (!srcSize) {
+        *dstSize = sizeof(header);
+        return HUFF_OK;
+    }
+    huffopts_t msgOpts;
+    getMessageOpts(ctx, &msgOpts);
+    resetTables(ctx, ctx->dict);
+    // any text has codes in the complete dictionary, so there is nothing to choose
+    if (ctx->dict && ctx->dict->complete) {
+        repeatRefTable(&ctx->ref, &ctx->scratch);
+    } else {
+        countBlockSymbols(text, srcSize, &msgOpts, &ctx->scratch);
+        selectCodeTable(&ctx->ref, &msgOpts, &ctx->scratch);
+    }
+
+    // message is encoded in place if the output has room for the worst case
+    size_t bound = blockPayloadBound(srcSize, &msgOpts);
+    uint8_t *payload = out + sizeof(header);
+    if (dstCapacity - sizeof(header) < bound && !(payload = reservePayloadBuf(ctx, bound))) {
+        return HUFF_ERR_MEMORY;
+    }
+    size_t payload_size = encodeBlock(text, srcSize, payload, &msgOpts, &ctx->scratch);
+    if (dstCapacity - sizeof(header) < payload_size) {
+        return HUFF_ERR_DST_SIZE;
+    }
+    if (payload != out + sizeof(header)) {
+        memcpy(out + sizeof(header), payload, payload_size);
+    }
+    *dstSize = sizeof(header) + payload_size;
+    return HUFF_OK;
+}
+
+huff_status_t huff_decompressMessage(huff_ctx_t *ctx, const void *src, size_t srcSize, void *dst, size_t dstCapacity, size_t *dstSize) {
+    const uint8_t *in = (const uint8_t*)src;
+    *dstSize = 0;
+    messageheader_t header;
+    if (srcSize < sizeof(header)) {
+        return !srcSize ? HUFF_ERR_EMPTY : HUFF_ERR_FORMAT;
+    }
+    memcpy(&header, in, sizeof(header));
+    if (header.dictId != (ctx->dict ? ctx->dict->id : 0)) {
+        return HUFF_ERR_DICT;
+    }
+    if (header.rawSize > dstCapacity) {
+        return HUFF_ERR_DST_SIZE;
+    }
+    huffopts_t msgOpts;
+    getMessageOpts(ctx, &msgOpts);
+    size_t payload_size = srcSize - sizeof(header);
+    if (!header.rawSize) {
+        return payload_size ? HUFF_ERR_CORRUPTED : HUFF_OK;
+    }
+    if (header.rawSize > HUFF_MAX_BLOCK_SIZE || payload_size > blockPayloadBound(header.rawSize, &msgOpts)) {
+        return HUFF_ERR_CORRUPTED;
+    }
+    // bit reader peeks one word past the payload, which the caller buffer may not have
+    uint8_t *payload = reservePayloadBuf(ctx, payload_size + sizeof(OUTBUF_T));
+    if (!payload) {
+        return HUFF_ERR_MEMORY;
+    }
+    memcpy(payload, in + sizeof(header), payload_size);
+    memset(payload + payload_size, 0, sizeof(OUTBUF_T));
+    resetTables(ctx, ctx->dict);
+    if (!readBlockTable(payload, payload_size, &msgOpts, &ctx->ref, &ctx->scratch)
+        || !decodeBlock(payload, payload_size, (INBUF_T*)dst, header.rawSize, &ctx->scratch, &msgOpts)) {
+        return HUFF_ERR_CORRUPTED;
+    }
+    *dstSize = header.rawSize;
+    return HUFF_OK;
+}
+
+const char* huff_strerror(huff_status_t status) {
+    switch (status) {
+        case HUFF_OK:
+            return HUFF_OK_MSG;
+        case HUFF_ERR_PARAM:
+            return WRONG_PARAM;
+        case HUFF_ERR_MEMORY:
+            return S_MALLOC_FAILED;
+        case HUFF_ERR_DST_SIZE:
+            return DST_TOO_SMALL;
+        case HUFF_ERR_EMPTY:
+            return FILE_IS_EMPTY;
+        case HUFF_ERR_FORMAT:
+            return WRONG_FORMAT;
+        case HUFF_ERR_CORRUPTED:
+            return CORRUPTED_BLOCK;
+        case HUFF_ERR_IO:
+            return IO_FAILED;
+        case HUFF_ERR_DICT:
+            return WRONG_DICT;
+        case HUFF_ERR_CHECKSUM:
+            return WRONG_CHECKSUM;
+        case HUFF_ERR_SYMBOL_SIZE:
+            return WRONG_SYMBOL_SIZE;
+    }
+    return WRONG_PARAM;
+}
@@ -0,0 +1,242 @@
+/**
+  @file libhuff.h
+  @brief Huffman compression library interface
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#ifndef LIBHUFF_H
+#define LIBHUFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HUFF_DEFAULT_BLOCK_SIZE (1u << 20)
+#define HUFF_MIN_BLOCK_SIZE (1u << 12)
+#define HUFF_MAX_BLOCK_SIZE (1u << 28)
+#define HUFF_MAX_THREADS 256
+#define HUFF_DEFAULT_CODE_LEN 15
+#define HUFF_MIN_CODE_LEN 8
+#define HUFF_MAX_CODE_LEN 32
+#define HUFF_MAX_STREAMS 8
+
+/**
+  Coding modes.
+*/
+typedef enum {
+    HUFF_MODE_ORDER0 = 0,  /**< one code table for every block */
+    HUFF_MODE_CTX1         /**< code table of every symbol is chosen by the previous symbol */
+} huff_mode_t;
+
+/**
+  Encoder options.
+*/
+typedef struct {
+    uint32_t blockSize;  /**< size of the independently encoded text blocks */
+    size_t threads;      /**< number of threads coding blocks in parallel */
+    uint8_t maxCodeLen;  /**< maximal length of the symbol code */
+    uint8_t streams;     /**< number of interleaved bitstreams in every block */
+    uint8_t mode;        /**< coding mode, one of huff_mode_t */
+    uint8_t symbolBits;  /**< width of the coded symbols, 8 or 16 bits; 16-bit symbols are coded in order0 mode only */
+} huffopts_t;
+
+/**
+  Result codes of the library functions.
+*/
+typedef enum {
+    HUFF_OK = 0,          /**< success */
+    HUFF_ERR_PARAM,       /**< wrong options or arguments */
+    HUFF_ERR_MEMORY,      /**< memory can't be allocated */
+    HUFF_ERR_DST_SIZE,    /**< output buffer is too small */
+    HUFF_ERR_EMPTY,       /**< encoded input is empty */
+    HUFF_ERR_FORMAT,      /**< input is not a huffman archive */
+    HUFF_ERR_CORRUPTED,   /**< encoded block is corrupted */
+    HUFF_ERR_IO,          /**< file can't be read or written */
+    HUFF_ERR_DICT,        /**< dictionary is invalid or doesn't match the encoded data */
+    HUFF_ERR_CHECKSUM,    /**< decoded block doesn't match its checksum */
+    HUFF_ERR_SYMBOL_SIZE  /**< input size or range isn't a multiple of the symbol size */
+} huff_status_t;
+
+/**
+  Estimated compression of the data, or of one block of it.
+*/
+typedef struct {
+    uint64_t rawSize;         /**< size of the original data in bytes */
+    uint64_t encodedSize;     /**< exact size of the compressed data in bytes, with all the headers, tables and the index */
+    double shannonBound;      /**< entropy of the blocks in bytes for the coding mode, without tables and headers */
+    uint64_t blocks;          /**< number of blocks */
+    uint64_t storedBlocks;    /**< number of blocks stored as is or as a run */
+    uint64_t repeatedTables;  /**< number of coded blocks repeating the previous code table */
+} huffestimate_t;
+
+/**
+  Standardized name for huffCtx structure.
+  Compression context keeps options, tables and scratch buffers between calls.
+*/
+typedef struct huffCtx huff_ctx_t;
+
+/**
+  @brief Set default options
+
+  @param[out] opts huffopts_t * Options to initialize
+*/
+void huff_initOpts(huffopts_t *opts);
+
+/**
+  @brief Check options
+
+  @param[in] opts huffopts_t * Options to check
+  @return HUFF_OK if all the options are in their ranges, HUFF_ERR_PARAM otherwise
+*/
+huff_status_t huff_checkOpts(const huffopts_t *opts);
+
+/**
+  @brief Create compression context
+
+  Context can be used for any number of compress and decompress calls, but by one thread at a time.
+  Buffers are coded as 8-bit symbols, data compressed with 16-bit symbols is rejected as HUFF_ERR_FORMAT.
+  @param[in] opts huffopts_t * Encoder options, NULL for defaults
+  @return Pointer to the new context, NULL if options are wrong, symbols aren't 8-bit or memory can't be allocated
+*/
+huff_ctx_t* huff_init(const huffopts_t *opts);
+
+/**
+  @brief Destroy compression context
+
+  @param[in] ctx huff_ctx_t ** Context to destroy
+*/
+void huff_free(huff_ctx_t **ctx);
+
+/**
+  @brief Calculate maximal size of the compressed data
+
+  @param[in] ctx huff_ctx_t * Context to compress with
+  @param[in] srcSize size_t Size of the data to compress
+  @return Size of the output buffer which is always enough for huff_compress
+*/
+size_t huff_compressBound(const huff_ctx_t *ctx, size_t srcSize);
+
+/**
+  @brief Compress buffer
+
+  Output has the same format as the encoded file.
+  Block is encoded directly to the output buffer of huff_compressBound size,
+  otherwise it is encoded to the context buffer first.
+  @param[in] ctx huff_ctx_t * Context
+  @param[in] src void * Data to compress
+  @param[in] srcSize size_t Size of the data
+  @param[out] dst void * Output buffer
+  @param[in] dstCapacity size_t Size of the output buffer
+  @param[out] dstSize size_t * Size of the compressed data
+  @return HUFF_OK or error code
+*/
+huff_status_t huff_compress(huff_ctx_t *ctx, const void *src, size_t srcSize, void *dst, size_t dstCapacity, size_t *dstSize);
+
+/**
+  @brief Decompress buffer
+
+  Blocks are decoded directly to the output buffer and verified against their checksums.
+  @param[in] ctx huff_ctx_t * Context
+  @param[in] src void * Compressed data
+  @param[in] srcSize size_t Size of the compressed data
+  @param[out] dst void * Output buffer
+  @param[in] dstCapacity size_t Size of the output buffer
+  @param[out] dstSize size_t * Size of the decompressed data
+  @return HUFF_OK or error code
+*/
+huff_status_t huff_decompress(huff_ctx_t *ctx, const void *src, size_t srcSize, void *dst, size_t dstCapacity, size_t *dstSize);
+
+/**
+  @brief Load dictionary
+
+  Dictionary is built by huff --train from the sample data.
+  Compressed data and messages start from its code tables, so blocks which fit them store no tables at all.
+  Its decoding tables are built right away and kept while no block replaces them.
+  Coding mode of the context is taken from the dictionary.
+  Data compressed with the dictionary can be decompressed only by a context with the same dictionary.
+  @param[in] ctx huff_ctx_t * Context
+  @param[in] dict void * Dictionary file content
+  @param[in] dictSize size_t Size of the dictionary
+  @return HUFF_OK, HUFF_ERR_DICT if the dictionary is invalid, or HUFF_ERR_MEMORY
+*/
+huff_status_t huff_loadDict(huff_ctx_t *ctx, const void *dict, size_t dictSize);
+
+/**
+  @brief Calculate maximal size of the compressed message
+
+  @param[in] ctx huff_ctx_t * Context to compress with
+  @param[in] srcSize size_t Size of the message
+  @return Size of the output buffer which is always enough for huff_compressMessage
+*/
+size_t huff_messageBound(const huff_ctx_t *ctx, size_t srcSize);
+
+/**
+  @brief Compress small message
+
+  Message is stored as the dictionary id and the size followed by one block, without the file header and index.
+  With a dictionary whose tables code every symbol, the block always repeats them, so only the text is coded.
+  Messages don't store the coding mode, so both sides should use the same dictionary or mode.
+  @param[in] ctx huff_ctx_t * Context
+  @param[in] src void * Message to compress, up to HUFF_MAX_BLOCK_SIZE bytes
+  @param[in] srcSize size_t Size of the message
+  @param[out] dst void * Output buffer
+  @param[in] dstCapacity size_t Size of the output buffer
+  @param[out] dstSize size_t * Size of the compressed message
+  @return HUFF_OK or error code
+*/
+huff_status_t huff_compressMessage(huff_ctx_t *ctx, const void *src, size_t srcSize, void *dst, size_t dstCapacity, size_t *dstSize);
+
+/**
+  @brief Decompress message compressed by huff_compressMessage
+
+  @param[in] ctx huff_ctx_t * Context with the dictionary the message was compressed with
+  @param[in] src void * Compressed message
+  @param[in] srcSize size_t Size of the compressed message
+  @param[out] dst void * Output buffer
+  @param[in] dstCapacity size_t Size of the output buffer
+  @param[out] dstSize size_t * Size of the message
+  @return HUFF_OK or error code
+*/
+huff_status_t huff_decompressMessage(huff_ctx_t *ctx, const void *src, size_t srcSize, void *dst, size_t dstCapacity, size_t *dstSize);
+
+/**
+  @brief Decompress range of the original data
+
+  Only the blocks overlapping the range are decoded, using the block index stored at the end of the compressed data,
+  so the time depends on the range size rather than the data size.
+  @param[in] ctx huff_ctx_t * Context
+  @param[in] src void * Whole compressed data
+  @param[in] srcSize size_t Size of the compressed data
+  @param[in] offset uint64_t Position of the range in the original data
+  @param[in] length size_t Size of the range, clipped to the end of the data
+  @param[out] dst void * Output buffer
+  @param[in] dstCapacity size_t Size of the output buffer
+  @param[out] dstSize size_t * Size of the decompressed range
+  @return HUFF_OK or error code
+*/
+huff_status_t huff_decompressRange(huff_ctx_t *ctx, const void *src, size_t srcSize, uint64_t offset, size_t length,
+                                   void *dst, size_t dstCapacity, size_t *dstSize);
+
+/**
+  @brief Estimate compression of buffer without encoding it
+
+  Only symbols are counted and code tables are chosen, the same way huff_compress does,
+  so the encoded size is exact while the time is close to the one of counting symbols.
+  @param[in] ctx huff_ctx_t * Context
+  @param[in] src void * Data to estimate
+  @param[in] srcSize size_t Size of the data
+  @param[out] estimate huffestimate_t * Size huff_compress would output and the Shannon bound of the data
+  @return HUFF_OK or error code
+*/
+huff_status_t huff_estimate(huff_ctx_t *ctx, const void *src, size_t srcSize, huffestimate_t *estimate);
+
+/**
+  @brief Get text description of the result code
+
+  @param[in] status huff_status_t Result code
+  @return Description
+*/
+const char* huff_strerror(huff_status_t status);
+
+#endif /* end of include guard: LIBHUFF_H */
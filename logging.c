@@ -10,11 +10,12 @@
 #include <stdio.h>
 
 void printError(char const *errorText) {
-    printf("%s %s%c\n", ERROR_PREFIX, errorText, '.');
+    // messages go to stderr, so they never mix with the coded stream written to stdout
+    fprintf(stderr, "%s %s%c\n", ERROR_PREFIX, errorText, '.');
 }
 
 void printInfo(char const *infoText) {
-    printf("%s %s%c\n", INFO_PREFIX, infoText, '.');
+    fprintf(stderr, "%s %s%c\n", INFO_PREFIX, infoText, '.');
 }
 
 void printUsage() {
@@ -12,14 +12,14 @@
 #include "msg.h"
 
 /**
-  @brief Prints error message with special prefix
+  @brief Prints error message with special prefix to stderr
 
   @param[in] errorText char* Message
 */
 void printError(char const *errorText);
 
 /**
-  @brief Prints informational message with special prefix
+  @brief Prints informational message with special prefix to stderr
 
   @param[in] infoText char* Message
 */
@@ -12,6 +12,27 @@
 // core.c
 #define WRONG_ARG_NUM "wrong number of arguments given"
 #define WRONG_ARG "wrong argument given"
+#define WRONG_BLOCK_SIZE "block size should be between 4K and 256M"
+#define WRONG_THREADS "number of threads should be between 1 and 256"
+#define WRONG_CODE_LEN "maximal code length should be between 8 and 32"
+#define WRONG_STREAMS "number of streams should be between 1 and 8"
+#define WRONG_MODE "coding mode should be order0 or ctx1"
+#define WRONG_WIDTH "symbol width should be 8 or 16"
+#define WRONG_WIDTH_ARGS "16-bit symbols are coded only in order0 mode, without dictionary and batch mode"
+#define WRONG_RANGE "range should be given as OFFSET:LENGTH in bytes"
+#define RANGE_NOT_DECODING "range can be given only for decoding with -x"
+#define WRONG_BATCH_ARGS "batch mode needs -c or -x, --batch and -o without file names"
+#define WRONG_TEST_ARGS "testing takes only the encoded file name"
+#define TEST_PASSED "all blocks are decoded and match their checksums"
+#define WRONG_ESTIMATE_ARGS "estimating takes only the file name to estimate"
+#define ESTIMATE_HEADER "     block       raw size        encoded  Shannon bound  type\n"
+#define ESTIMATE_BLOCK "%10llu %14llu %14llu %14.1f  %s\n"
+#define ESTIMATE_STORED "stored"
+#define ESTIMATE_REPEATED "repeated table"
+#define ESTIMATE_NEW_TABLE "new table"
+#define ESTIMATE_REPORT "%llu bytes, %llu encoded (%.3f), Shannon bound %.1f bytes (%.3f), %llu blocks, %llu stored, %llu repeated tables\n"
+#define WRONG_TRAIN_ARGS "training takes only the sample and the dictionary file names"
+#define STATS_DISABLED "statistics are not compiled in, rebuild with make STATS=1"
 
 // stdsafe.c
 #define S_MALLOC_FAILED "memory can't be allocated"
@@ -19,8 +40,67 @@
 #define S_FOPEN_FAILED "can\'t open file"
 #define S_EXIT_MSG "app closed unexpectedly with exit code"
 
+// fileio.c
+#define FTRUNCATE_FAILED "output file size can't be set"
+
+// thpool.c
+#define THREAD_CREATE_FAILED "thread can't be created"
+
+// libhuff.c
+#define HUFF_OK_MSG "success"
+#define WRONG_PARAM "wrong options given"
+#define DST_TOO_SMALL "output buffer is too small"
+#define IO_FAILED "file can't be read or written"
+#define WRONG_DICT "dictionary is invalid or doesn't match the input"
+#define WRONG_CHECKSUM "decoded block doesn't match its checksum"
+#define WRONG_SYMBOL_SIZE "input size or range isn't a multiple of the symbol size"
+
+// bench.c
+#define BENCH_READ_FAILED "benchmark file can't be read"
+#define BENCH_MISMATCH "decoded block differs from the original"
+#define BENCH_USAGE_MSG "Usage:\n  huffbench [options] [files...]\n"\
+    "Options:\n"\
+    "  -n runs  number of runs of every corpus (default 5)\n"\
+    "  -s size  size of the generated corpora in bytes (default 8388608)\n"\
+    "  -B size  block size in bytes\n"\
+    "  -S num   number of interleaved bitstreams\n"\
+    "  --max-code-len len  limit symbol codes length\n"\
+    "  -m mode  coding mode, order0 or ctx1, ctx1 is compared with order0\n"\
+    "  -o file  write results in CSV format"
+
+// batch.c
+#define BATCH_SOURCE_FAILED "batch list or directory can't be read"
+#define BATCH_OUTDIR_FAILED "output directory can't be created"
+#define BATCH_DUPLICATE_OUTPUT "output name repeats the one of an earlier file, file is skipped"
+#define BATCH_REPORT "%zu files, %zu failed, %llu bytes in, %llu bytes out, %.3f s, %.1f MB/s\n"
+
 // logging.c
-#define USAGE_MSG "Usage:\n  huff ifile [-c|-x] ofile"
+#define USAGE_MSG "Usage:\n  huff ifile [-c|-x] ofile [options]\n"\
+    "  huff [-c|-x] --batch list|dir -o outdir [options]\n"\
+    "  huff -t ifile [-T num] [-D dict]\n"\
+    "  huff --estimate ifile [options]\n"\
+    "  huff sample --train dict [-m mode]\n"\
+    "  - as ifile or ofile stands for stdin or stdout\n"\
+    "Options:\n"\
+    "  -B size  encode input by blocks of given size, K and M suffixes are allowed (default 1M)\n"\
+    "  -T num   number of threads (default 1), in batch mode number of files coded at once\n"\
+    "  --batch list|dir  code every file of the directory or every path of the list file,\n"\
+    "           encoded files get .huf suffix, failed files don't stop the others\n"\
+    "  -o outdir  directory for the files coded in batch mode\n"\
+    "  -S num   split every block into given number of interleaved bitstreams, 1-8 (default 1)\n"\
+    "  --max-code-len len  limit symbol codes length, 8-32 bits (default 15)\n"\
+    "  -m mode  coding mode: order0 uses one code table per block,\n"\
+    "           ctx1 chooses the table by the previous byte (default order0)\n"\
+    "  -w bits  width of the coded symbols, 8 or 16 (default 8); 16-bit symbols suit arrays\n"\
+    "           of 16-bit samples, input size should be even, decoding takes the width from the input\n"\
+    "  -t       decode the input without writing it and verify every block checksum\n"\
+    "  --estimate  print exact encoded size and Shannon bound of every block and of the whole input\n"\
+    "           without encoding it, taking about the time of counting symbols\n"\
+    "  --range off:len  decode only len bytes starting at off, input should be a regular file\n"\
+    "  --train  build dictionary of code tables from the sample file\n"\
+    "  -D dict  start every file from the dictionary tables, decoding needs the same dictionary;\n"\
+    "           coding mode is taken from the dictionary\n"\
+    "  --stats[=json]  print time of every coding stage and counters"
 #define ERROR_PREFIX "Error:"
 #define INFO_PREFIX "Info:"
 
@@ -28,5 +108,7 @@
 #define FILE_IS_EMPTY "input file is empty"
 #define ENCODING_START "file encoding started"
 #define DECODING_START "file decoding started"
+#define WRONG_FORMAT "input file is not a huffman archive"
+#define CORRUPTED_BLOCK "encoded block is corrupted"
 
 #endif /* end of include guard: ERRORMSG_H */
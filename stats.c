@@ -0,0 +1,83 @@
+/**
+  @file stats.c
+  @brief Coding statistics
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#define _POSIX_C_SOURCE 200809L
+#include "stats.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char *stageNames[ST_STAGES] = {"read", "hist", "table", "code", "write", "total"};
+
+/**
+  Number of memory allocations made since the start.
+*/
+static atomic_uint_fast64_t allocCount;
+
+double st_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void st_lap(huffstats_t *stats, ststage_t stage, double *timer) {
+    double now = st_now();
+    if (stats) {
+        stats->time[stage] += now - *timer;
+    }
+    *timer = now;
+}
+
+void st_merge(huffstats_t *stats, huffstats_t *block) {
+    if (stats) {
+        for (size_t stage = 0; stage < ST_STAGES; stage++) {
+            stats->time[stage] += block->time[stage];
+        }
+        stats->blocks += block->blocks;
+        stats->symbols += block->symbols;
+        stats->payloadBits += block->payloadBits;
+        stats->repeatedTables += block->repeatedTables;
+        stats->storedBlocks += block->storedBlocks;
+        stats->maxCodeLen = block->maxCodeLen > stats->maxCodeLen ? block->maxCodeLen : stats->maxCodeLen;
+    }
+    memset(block, 0, sizeof(huffstats_t));
+}
+
+void st_countAlloc(void) {
+    atomic_fetch_add_explicit(&allocCount, 1, memory_order_relaxed);
+}
+
+void st_print(huffstats_t *stats, bool json, FILE *file) {
+    stats->allocs = atomic_load(&allocCount);
+    double bitsPerSymbol = stats->symbols ? (double)stats->payloadBits / stats->symbols : 0;
+    if (json) {
+        fprintf(file, "{\"time\":{");
+        for (size_t stage = 0; stage < ST_STAGES; stage++) {
+            fprintf(file, "%s\"%s\":%.6f", stage ? "," : "", stageNames[stage], stats->time[stage]);
+        }
+        fprintf(file, "},\"bytesIn\":%llu,\"bytesOut\":%llu,\"blocks\":%llu,\"symbols\":%llu,"
+               "\"bitsPerSymbol\":%.4f,\"repeatedTables\":%llu,\"storedBlocks\":%llu,\"maxCodeLen\":%u,\"allocs\":%llu}\n",
+               (unsigned long long)stats->bytesIn, (unsigned long long)stats->bytesOut,
+               (unsigned long long)stats->blocks, (unsigned long long)stats->symbols,
+               bitsPerSymbol, (unsigned long long)stats->repeatedTables, (unsigned long long)stats->storedBlocks, stats->maxCodeLen, (unsigned long long)stats->allocs);
+        return;
+    }
+    for (size_t stage = 0; stage < ST_STAGES; stage++) {
+        fprintf(file, "%-16s %12.6f s\n", stageNames[stage], stats->time[stage]);
+    }
+    fprintf(file, "%-16s %12llu\n", "bytes in", (unsigned long long)stats->bytesIn);
+    fprintf(file, "%-16s %12llu\n", "bytes out", (unsigned long long)stats->bytesOut);
+    fprintf(file, "%-16s %12llu\n", "blocks", (unsigned long long)stats->blocks);
+    fprintf(file, "%-16s %12llu\n", "symbols", (unsigned long long)stats->symbols);
+    fprintf(file, "%-16s %12.4f\n", "bits per symbol", bitsPerSymbol);
+    fprintf(file, "%-16s %12llu\n", "repeated tables", (unsigned long long)stats->repeatedTables);
+    fprintf(file, "%-16s %12llu\n", "stored blocks", (unsigned long long)stats->storedBlocks);
+    fprintf(file, "%-16s %12u\n", "max code length", stats->maxCodeLen);
+    fprintf(file, "%-16s %12llu\n", "allocations", (unsigned long long)stats->allocs);
+}
@@ -0,0 +1,122 @@
+/**
+  @file stats.h
+  @brief Coding statistics
+
+  Instrumentation is compiled in only if HUFF_STATS is defined,
+  otherwise all the STATS_* macros expand to nothing.
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+  Timed coding stages.
+*/
+typedef enum {
+    ST_READ,   /**< reading input */
+    ST_HIST,   /**< counting symbol frequencies */
+    ST_TABLE,  /**< building code or decoding tables */
+    ST_CODE,   /**< encoding or decoding loop */
+    ST_WRITE,  /**< writing output */
+    ST_TOTAL,  /**< whole coding wall time */
+    ST_STAGES
+} ststage_t;
+
+/**
+  Coding statistics.
+  Times of the stages run by the thread pool are summed over all the threads.
+*/
+typedef struct {
+    double time[ST_STAGES];  /**< time of every stage in seconds */
+    uint64_t bytesIn;        /**< size of the input */
+    uint64_t bytesOut;       /**< size of the output */
+    uint64_t blocks;         /**< number of coded blocks */
+    uint64_t symbols;        /**< number of coded symbols */
+    uint64_t payloadBits;    /**< size of the encoded blocks in bits */
+    uint64_t repeatedTables; /**< number of blocks repeating the previous code table */
+    uint64_t storedBlocks;   /**< number of blocks stored as is or as a run */
+    uint8_t maxCodeLen;      /**< maximal code length */
+    uint64_t allocs;         /**< number of memory allocations */
+} huffstats_t;
+
+#ifdef HUFF_STATS
+/**
+  Starts timer.
+*/
+#define STATS_START(timer) double timer = st_now()
+/**
+  Adds time since the timer start to the stage and restarts the timer.
+*/
+#define STATS_LAP(stats, stage, timer) st_lap((stats), (stage), &(timer))
+/**
+  Adds value to the counter.
+*/
+#define STATS_ADD(stats, field, value) do { if (stats) { (stats)->field += (value); } } while (0)
+/**
+  Raises the counter to the value.
+*/
+#define STATS_MAX(stats, field, value) do { if ((stats) && (stats)->field < (value)) { (stats)->field = (value); } } while (0)
+/**
+  Adds statistics of a block to the total ones and resets them.
+*/
+#define STATS_MERGE(stats, block) st_merge((stats), (block))
+/**
+  Counts one memory allocation.
+*/
+#define STATS_ALLOC() st_countAlloc()
+#else
+#define STATS_START(timer)
+#define STATS_LAP(stats, stage, timer)
+#define STATS_ADD(stats, field, value)
+#define STATS_MAX(stats, field, value)
+#define STATS_MERGE(stats, block)
+#define STATS_ALLOC()
+#endif
+
+/**
+  @brief Gets monotonic time
+
+  @return Time in seconds
+*/
+double st_now(void);
+
+/**
+  @brief Adds time since the timer start to the stage and restarts the timer
+
+  @param[in,out] stats huffstats_t * Statistics, may be NULL
+  @param[in] stage ststage_t Stage
+  @param[in,out] timer double * Timer start
+*/
+void st_lap(huffstats_t *stats, ststage_t stage, double *timer);
+
+/**
+  @brief Adds statistics of a block to the total ones and resets them
+
+  @param[in,out] stats huffstats_t * Total statistics, may be NULL
+  @param[in,out] block huffstats_t * Block statistics
+*/
+void st_merge(huffstats_t *stats, huffstats_t *block);
+
+/**
+  @brief Counts one memory allocation
+*/
+void st_countAlloc(void);
+
+/**
+  @brief Prints statistics
+
+  Takes number of allocations made since the start.
+  @param[in,out] stats huffstats_t * Statistics
+  @param[in] json bool Print JSON instead of a table
+  @param[in] file FILE * File to print to
+*/
+void st_print(huffstats_t *stats, bool json, FILE *file);
+
+#endif /* end of include guard: STATS_H */
@@ -8,30 +8,34 @@
 */
 #include "stdsafe.h"
 #include "core.h"
+#include "stats.h"
 
 void* s_malloc(size_t size) {
+    STATS_ALLOC();
     void *buf = aligned_alloc(128, size);
     if(!buf && size) {
         printError(S_MALLOC_FAILED);
-        s_exit(0);
+        s_exit(EXIT_FAILURE);
     }
     return buf;
 }
 
 void *s_calloc(size_t nmemb, size_t size) {
+    STATS_ALLOC();
     void *buf = calloc(nmemb, size);
     if(!buf && size) {
         printError(S_MALLOC_FAILED);
-        s_exit(0);
+        s_exit(EXIT_FAILURE);
     }
     return buf;
 }
 
 void *s_realloc(void *ptr, size_t size) {
+    STATS_ALLOC();
     void *buf = realloc(ptr, size);
     if(!buf && size) {
         printError(S_REALLOC_FAILED);
-        s_exit(0);
+        s_exit(EXIT_FAILURE);
     }
     return buf;
 }
@@ -41,7 +45,7 @@ void s_exit(int code) {
     char *infoMsg = (char*)s_malloc(infoMsgLength*sizeof(char));
     snprintf(infoMsg, infoMsgLength, "%s %d", S_EXIT_MSG, code);
     printInfo(infoMsg);
-    exit(0);
+    exit(code);
 }
 
 FILE* s_fopen(const char *filename, const char *mode) {
@@ -53,7 +57,7 @@ FILE* s_fopen(const char *filename, const char *mode) {
         printError(errorMsg);
         free(errorMsg);
         errorMsg = NULL;
-        s_exit(0);
+        s_exit(EXIT_FAILURE);
     }
     return file;
 }
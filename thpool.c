@@ -0,0 +1,214 @@
+/**
+  @file thpool.c
+  @brief Worker thread pool for running independent jobs in parallel
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#include "thpool.h"
+#include <threads.h>
+#include "core.h"
+
+/**
+  Thread pool structure.
+  Contains worker threads and description of the current run.
+*/
+struct thPool {
+    thrd_t *workers;     /**< worker threads */
+    size_t threads;      /**< number of threads including calling one */
+    mtx_t lock;          /**< protects all the fields below */
+    cnd_t started;       /**< signaled when new run starts or pool stops */
+    cnd_t finished;      /**< signaled when the last job of the run is finished */
+    thjob_t job;         /**< job function of the current run */
+    char *args;          /**< job arguments of the current run */
+    size_t argSize;      /**< size of one job argument */
+    size_t count;        /**< number of jobs in the current run */
+    size_t next;         /**< index of the next job to take */
+    size_t done;         /**< number of finished jobs */
+    uint64_t run;        /**< number of the current run */
+    bool stop;           /**< workers should exit */
+};
+
+/**
+  Pipeline stage structure.
+  Contains the stage thread and its current job.
+*/
+struct thStage {
+    thrd_t thread;       /**< stage thread */
+    mtx_t lock;          /**< protects all the fields below */
+    cnd_t changed;       /**< signaled when job is started or finished, or stage stops */
+    thjob_t job;         /**< current job, NULL if there is none */
+    void *arg;           /**< argument of the current job */
+    bool stop;           /**< thread should exit */
+};
+
+/**
+  @brief Take and run jobs of the current run until none left
+
+  Should be called with the pool lock held, returns with the lock held.
+  @param[in] pool thpool_t * Pool
+*/
+static void tp_work(thpool_t *pool) {
+    while (pool->next < pool->count) {
+        size_t index = pool->next++;
+        thjob_t job = pool->job;
+        void *arg = pool->args + index * pool->argSize;
+        mtx_unlock(&pool->lock);
+        job(arg);
+        mtx_lock(&pool->lock);
+        if (++pool->done == pool->count) {
+            cnd_broadcast(&pool->finished);
+        }
+    }
+}
+
+/**
+  @brief Worker thread entry point
+
+  @param[in] arg void * Pool
+  @return 0
+*/
+static int tp_worker(void *arg) {
+    thpool_t *pool = (thpool_t*)arg;
+    uint64_t lastRun = 0;
+    mtx_lock(&pool->lock);
+    while (true) {
+        while (!pool->stop && pool->run == lastRun) {
+            cnd_wait(&pool->started, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        lastRun = pool->run;
+        tp_work(pool);
+    }
+    mtx_unlock(&pool->lock);
+    return 0;
+}
+
+thpool_t* tp_init(size_t threads) {
+    thpool_t *pool = (thpool_t*)s_calloc(1, sizeof(thpool_t));
+    pool->threads = threads ? threads : 1;
+    mtx_init(&pool->lock, mtx_plain);
+    cnd_init(&pool->started);
+    cnd_init(&pool->finished);
+    pool->workers = (thrd_t*)s_calloc(pool->threads, sizeof(thrd_t));
+    for (size_t i = 1; i < pool->threads; i++) {
+        if (thrd_create(&pool->workers[i], tp_worker, pool) != thrd_success) {
+            printError(THREAD_CREATE_FAILED);
+            s_exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+void tp_free(thpool_t **pool) {
+    mtx_lock(&(*pool)->lock);
+    (*pool)->stop = true;
+    cnd_broadcast(&(*pool)->started);
+    mtx_unlock(&(*pool)->lock);
+    for (size_t i = 1; i < (*pool)->threads; i++) {
+        thrd_join((*pool)->workers[i], NULL);
+    }
+    cnd_destroy(&(*pool)->finished);
+    cnd_destroy(&(*pool)->started);
+    mtx_destroy(&(*pool)->lock);
+    free((*pool)->workers);
+    free(*pool);
+    *pool = NULL;
+}
+
+/**
+  @brief Stage thread entry point
+
+  @param[in] arg void * Stage
+  @return 0
+*/
+static int tp_stageWorker(void *arg) {
+    thstage_t *stage = (thstage_t*)arg;
+    mtx_lock(&stage->lock);
+    while (true) {
+        while (!stage->stop && !stage->job) {
+            cnd_wait(&stage->changed, &stage->lock);
+        }
+        if (!stage->job) {
+            break;
+        }
+        thjob_t job = stage->job;
+        void *jobArg = stage->arg;
+        mtx_unlock(&stage->lock);
+        job(jobArg);
+        mtx_lock(&stage->lock);
+        stage->job = NULL;
+        cnd_broadcast(&stage->changed);
+    }
+    mtx_unlock(&stage->lock);
+    return 0;
+}
+
+thstage_t* tp_stageInit(void) {
+    thstage_t *stage = (thstage_t*)s_calloc(1, sizeof(thstage_t));
+    mtx_init(&stage->lock, mtx_plain);
+    cnd_init(&stage->changed);
+    if (thrd_create(&stage->thread, tp_stageWorker, stage) != thrd_success) {
+        printError(THREAD_CREATE_FAILED);
+        s_exit(EXIT_FAILURE);
+    }
+    return stage;
+}
+
+void tp_stageFree(thstage_t **stage) {
+    mtx_lock(&(*stage)->lock);
+    (*stage)->stop = true;
+    cnd_broadcast(&(*stage)->changed);
+    mtx_unlock(&(*stage)->lock);
+    thrd_join((*stage)->thread, NULL);
+    cnd_destroy(&(*stage)->changed);
+    mtx_destroy(&(*stage)->lock);
+    free(*stage);
+    *stage = NULL;
+}
+
+void tp_stageStart(thstage_t *stage, thjob_t job, void *arg) {
+    mtx_lock(&stage->lock);
+    while (stage->job) {
+        cnd_wait(&stage->changed, &stage->lock);
+    }
+    stage->job = job;
+    stage->arg = arg;
+    cnd_broadcast(&stage->changed);
+    mtx_unlock(&stage->lock);
+}
+
+void tp_stageWait(thstage_t *stage) {
+    mtx_lock(&stage->lock);
+    while (stage->job) {
+        cnd_wait(&stage->changed, &stage->lock);
+    }
+    mtx_unlock(&stage->lock);
+}
+
+size_t tp_threads(const thpool_t *pool) {
+    return pool->threads;
+}
+
+void tp_run(thpool_t *pool, thjob_t job, void *args, size_t argSize, size_t count) {
+    if (!count) {
+        return;
+    }
+    mtx_lock(&pool->lock);
+    pool->job = job;
+    pool->args = (char*)args;
+    pool->argSize = argSize;
+    pool->count = count;
+    pool->next = 0;
+    pool->done = 0;
+    pool->run++;
+    cnd_broadcast(&pool->started);
+    tp_work(pool);
+    while (pool->done < pool->count) {
+        cnd_wait(&pool->finished, &pool->lock);
+    }
+    mtx_unlock(&pool->lock);
+}
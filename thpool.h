@@ -0,0 +1,100 @@
+/**
+  @file thpool.h
+  @brief Worker thread pool for running independent jobs in parallel
+
+  @author Zaitsev Yury
+  @copyright Copyright (c) 2016, Zaitsev Yury
+  @license This file is released under the GNU Public License
+*/
+#ifndef THPOOL_H
+#define THPOOL_H
+
+#include <stddef.h>
+
+/**
+  Job function type.
+  Gets pointer to the job argument.
+*/
+typedef void (*thjob_t)(void *arg);
+
+/**
+  Standardized name for thPool structure
+*/
+typedef struct thPool thpool_t;
+
+/**
+  Standardized name for thStage structure
+*/
+typedef struct thStage thstage_t;
+
+/**
+  @brief Create thread pool
+
+  Calling thread takes part in every run, so threads - 1 workers are started.
+  @param[in] threads size_t Total number of threads running jobs
+  @return Pointer to the new thread pool
+*/
+thpool_t* tp_init(size_t threads);
+
+/**
+  @brief Stop all the workers and destroy thread pool
+
+  @param[in] pool thpool_t ** Pool to destroy
+*/
+void tp_free(thpool_t **pool);
+
+/**
+  @brief Get number of threads running jobs
+
+  @param[in] pool thpool_t * Pool
+  @return Number of threads including calling one
+*/
+size_t tp_threads(const thpool_t *pool);
+
+/**
+  @brief Run job function for every element of the arguments array
+
+  Returns when all the jobs are finished.
+  @param[in] pool thpool_t * Pool to run jobs on
+  @param[in] job thjob_t Job function
+  @param[in] args void * Array of job arguments
+  @param[in] argSize size_t Size of one job argument
+  @param[in] count size_t Number of jobs
+*/
+void tp_run(thpool_t *pool, thjob_t job, void *args, size_t argSize, size_t count);
+
+/**
+  @brief Create pipeline stage
+
+  Stage is one thread running one job at a time in the background,
+  so reading and writing of a file overlap with coding on the pool.
+  @return Pointer to the new stage
+*/
+thstage_t* tp_stageInit(void);
+
+/**
+  @brief Wait for the current job and destroy pipeline stage
+
+  @param[in] stage thstage_t ** Stage to destroy
+*/
+void tp_stageFree(thstage_t **stage);
+
+/**
+  @brief Start job on the stage thread
+
+  Waits for the previous job of the stage first.
+  @param[in] stage thstage_t * Stage
+  @param[in] job thjob_t Job function
+  @param[in] arg void * Job argument
+*/
+void tp_stageStart(thstage_t *stage, thjob_t job, void *arg);
+
+/**
+  @brief Wait for the job of the stage to finish
+
+  Returns at once if no job was started.
+  @param[in] stage thstage_t * Stage
+*/
+void tp_stageWait(thstage_t *stage);
+
+#endif /* end of include guard: THPOOL_H */